@@ -0,0 +1,155 @@
+#include "pch.h"
+#include "DurationIndex.h"
+
+namespace {
+size_t LowBit(size_t value) {
+  return value & (~value + 1);
+}
+}  // namespace
+
+void DurationIndex::Reset(const std::vector<MacroAction>& actions, const BlockTable* blocks) {
+  std::vector<double> durations;
+  durations.reserve(actions.size());
+  for (const auto& action : actions) {
+    durations.push_back(StepDuration(action, blocks));
+  }
+  Build(durations);
+}
+
+void DurationIndex::Build(const std::vector<double>& durations) {
+  const size_t count = durations.size();
+  m_durations.assign(count + 1, 0.0);
+  m_durationTree.assign(count + 1, 0.0);
+  m_liveTree.assign(count + 1, 0);
+  m_live.assign(count + 1, 1);
+  m_live[0] = 0;
+  m_liveCount = count;
+
+  // Linear-time build: seed each node with its own value, then push it to its parent.
+  for (size_t slot = 1; slot <= count; ++slot) {
+    m_durations[slot] = durations[slot - 1];
+    m_durationTree[slot] += m_durations[slot];
+    m_liveTree[slot] += 1;
+    size_t parent = slot + LowBit(slot);
+    if (parent <= count) {
+      m_durationTree[parent] += m_durationTree[slot];
+      m_liveTree[parent] += m_liveTree[slot];
+    }
+  }
+}
+
+void DurationIndex::Clear() {
+  Build({});
+}
+
+void DurationIndex::Append(double duration) {
+  const size_t slot = m_durations.size();
+  const size_t rangeStart = slot - LowBit(slot);
+  // A new node covers (slot - lowbit, slot]; everything before it in that range already exists.
+  m_durationTree.push_back(duration + DurationPrefix(slot - 1) - DurationPrefix(rangeStart));
+  m_liveTree.push_back(1 + LivePrefix(slot - 1) - LivePrefix(rangeStart));
+  m_durations.push_back(duration);
+  m_live.push_back(1);
+  ++m_liveCount;
+}
+
+void DurationIndex::Erase(size_t index) {
+  if (index >= m_liveCount) {
+    return;
+  }
+  size_t slot = SlotForIndex(index);
+  AddDuration(slot, -m_durations[slot]);
+  AddLive(slot, -1);
+  m_durations[slot] = 0.0;
+  m_live[slot] = 0;
+  --m_liveCount;
+
+  if (m_durations.size() - 1 - m_liveCount > m_liveCount + 64) {
+    Compact();
+  }
+}
+
+void DurationIndex::Set(size_t index, double duration) {
+  if (index >= m_liveCount) {
+    return;
+  }
+  size_t slot = SlotForIndex(index);
+  AddDuration(slot, duration - m_durations[slot]);
+  m_durations[slot] = duration;
+}
+
+double DurationIndex::Total() const {
+  return DurationPrefix(m_durations.size() - 1);
+}
+
+double DurationIndex::Duration(size_t index) const {
+  if (index >= m_liveCount) {
+    return 0.0;
+  }
+  return m_durations[SlotForIndex(index)];
+}
+
+double DurationIndex::StartOffset(size_t index) const {
+  if (index >= m_liveCount) {
+    return Total();
+  }
+  return DurationPrefix(SlotForIndex(index) - 1);
+}
+
+size_t DurationIndex::SlotForIndex(size_t index) const {
+  // Fenwick descent for the smallest slot whose live prefix count is index + 1.
+  const size_t size = m_liveTree.size() - 1;
+  size_t step = 1;
+  while (step * 2 <= size) {
+    step *= 2;
+  }
+  size_t slot = 0;
+  int32_t remaining = static_cast<int32_t>(index) + 1;
+  for (; step > 0; step /= 2) {
+    size_t next = slot + step;
+    if (next <= size && m_liveTree[next] < remaining) {
+      slot = next;
+      remaining -= m_liveTree[next];
+    }
+  }
+  return slot + 1;
+}
+
+void DurationIndex::AddDuration(size_t slot, double delta) {
+  for (; slot < m_durationTree.size(); slot += LowBit(slot)) {
+    m_durationTree[slot] += delta;
+  }
+}
+
+void DurationIndex::AddLive(size_t slot, int32_t delta) {
+  for (; slot < m_liveTree.size(); slot += LowBit(slot)) {
+    m_liveTree[slot] += delta;
+  }
+}
+
+double DurationIndex::DurationPrefix(size_t slot) const {
+  double sum = 0.0;
+  for (; slot > 0; slot -= LowBit(slot)) {
+    sum += m_durationTree[slot];
+  }
+  return sum;
+}
+
+int32_t DurationIndex::LivePrefix(size_t slot) const {
+  int32_t sum = 0;
+  for (; slot > 0; slot -= LowBit(slot)) {
+    sum += m_liveTree[slot];
+  }
+  return sum;
+}
+
+void DurationIndex::Compact() {
+  std::vector<double> live;
+  live.reserve(m_liveCount);
+  for (size_t slot = 1; slot < m_durations.size(); ++slot) {
+    if (m_live[slot]) {
+      live.push_back(m_durations[slot]);
+    }
+  }
+  Build(live);
+}
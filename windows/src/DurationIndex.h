@@ -0,0 +1,40 @@
+#pragma once
+
+#include "MacroAction.h"
+
+#include <cstdint>
+#include <vector>
+
+// Fenwick trees over per-step durations and live-step counts. Appends,
+// edits and deletes are O(log n); deleted steps leave a zero-duration
+// tombstone that is compacted away once tombstones outnumber live steps.
+class DurationIndex {
+ public:
+  void Reset(const std::vector<MacroAction>& actions, const BlockTable* blocks = nullptr);
+  void Clear();
+  void Append(double duration);
+  void Erase(size_t index);
+  void Set(size_t index, double duration);
+
+  size_t Count() const { return m_liveCount; }
+  double Total() const;
+  double Duration(size_t index) const;
+  // Sum of the durations of every step before index.
+  double StartOffset(size_t index) const;
+
+ private:
+  void Build(const std::vector<double>& durations);
+  size_t SlotForIndex(size_t index) const;
+  void AddDuration(size_t slot, double delta);
+  void AddLive(size_t slot, int32_t delta);
+  double DurationPrefix(size_t slot) const;
+  int32_t LivePrefix(size_t slot) const;
+  void Compact();
+
+  // Slots are 1-based to match the usual Fenwick layout; index 0 is unused.
+  std::vector<double> m_durations{0.0};
+  std::vector<double> m_durationTree{0.0};
+  std::vector<int32_t> m_liveTree{0};
+  std::vector<char> m_live{0};
+  size_t m_liveCount = 0;
+};
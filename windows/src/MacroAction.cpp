@@ -1,12 +1,97 @@
 #include "pch.h"
 #include "MacroAction.h"
+#include "MacroLibrary.h"
+#include "Trace.h"
 
 #include <objbase.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
+#include <iterator>
 #include <sstream>
+#include <unordered_map>
 
 using winrt::Windows::Data::Json::JsonArray;
 using winrt::Windows::Data::Json::JsonObject;
+using winrt::Windows::Data::Json::JsonValue;
+using winrt::Windows::Data::Json::JsonValueType;
+
+namespace {
+using DurationMemo = std::unordered_map<std::string, double>;
+
+double StepDurationAtDepth(const MacroAction& action, const BlockTable* blocks, DurationMemo& memo, int depth) {
+  if (action.kind == ActionKind::Burst && action.count > 0) {
+    return action.delay + action.interval * static_cast<double>(action.count);
+  }
+  if (action.kind == ActionKind::Call && blocks && depth < kMaxCallDepth) {
+    auto found = blocks->find(action.block);
+    if (found == blocks->end()) {
+      return action.delay;
+    }
+    // Each block is summed once per walk, so shared sub-blocks do not
+    // multiply the work by the branching factor at every level.
+    auto known = memo.find(action.block);
+    if (known == memo.end()) {
+      double blockDuration = 0.0;
+      for (const auto& inner : *found->second) {
+        blockDuration += StepDurationAtDepth(inner, blocks, memo, depth + 1);
+      }
+      known = memo.emplace(action.block, blockDuration).first;
+    }
+    return action.delay + known->second * static_cast<double>(std::max(1, action.repeat));
+  }
+  return action.delay;
+}
+
+// Returns the length of the longest block chain starting at id, capped at
+// kMaxCallDepth + 1 for cycles and over-deep chains. A height of 0 marks a
+// block that is still on the stack.
+int BlockHeight(const std::string& id, const BlockTable& blocks, std::unordered_map<std::string, int>& height,
+                int depth) {
+  auto known = height.find(id);
+  if (known != height.end()) {
+    return known->second == 0 ? kMaxCallDepth + 1 : known->second;
+  }
+  auto found = blocks.find(id);
+  if (found == blocks.end()) {
+    return 0;
+  }
+  if (depth >= kMaxCallDepth) {
+    return kMaxCallDepth + 1;
+  }
+  height.emplace(id, 0);
+  int deepest = 0;
+  for (const auto& action : *found->second) {
+    if (action.kind == ActionKind::Call) {
+      deepest = std::max(deepest, BlockHeight(action.block, blocks, height, depth + 1));
+      if (deepest >= kMaxCallDepth) {
+        return kMaxCallDepth + 1;
+      }
+    }
+  }
+  height[id] = deepest + 1;
+  return deepest + 1;
+}
+
+void CollectReferencedBlocks(const std::vector<MacroAction>& steps, const BlockTable& blocks,
+                             std::vector<std::string>& order, int depth) {
+  if (depth >= kMaxCallDepth) {
+    return;
+  }
+  for (const auto& action : steps) {
+    if (action.kind != ActionKind::Call || std::find(order.begin(), order.end(), action.block) != order.end()) {
+      continue;
+    }
+    auto found = blocks.find(action.block);
+    if (found == blocks.end()) {
+      continue;
+    }
+    order.push_back(action.block);
+    CollectReferencedBlocks(*found->second, blocks, order, depth + 1);
+  }
+}
+}  // namespace
 
 std::string GenerateGuidString() {
   GUID guid{};
@@ -32,6 +117,10 @@ std::string KindToString(ActionKind kind) {
       return "otherClick";
     case ActionKind::Wait:
       return "wait";
+    case ActionKind::Burst:
+      return "burst";
+    case ActionKind::Call:
+      return "call";
   }
   return "wait";
 }
@@ -46,6 +135,12 @@ ActionKind KindFromString(const std::string& value) {
   if (value == "otherClick") {
     return ActionKind::OtherClick;
   }
+  if (value == "burst") {
+    return ActionKind::Burst;
+  }
+  if (value == "call") {
+    return ActionKind::Call;
+  }
   return ActionKind::Wait;
 }
 
@@ -59,12 +154,20 @@ std::wstring KindLabel(ActionKind kind) {
       return L"Other";
     case ActionKind::Wait:
       return L"Wait";
+    case ActionKind::Burst:
+      return L"Burst";
+    case ActionKind::Call:
+      return L"Call";
   }
   return L"Wait";
 }
 
+bool HasPosition(const MacroAction& action) {
+  return action.kind != ActionKind::Wait && action.kind != ActionKind::Call;
+}
+
 std::wstring LocationLabel(const MacroAction& action) {
-  if (action.kind == ActionKind::Wait) {
+  if (!HasPosition(action)) {
     return L"-";
   }
   std::wstringstream stream;
@@ -72,31 +175,104 @@ std::wstring LocationLabel(const MacroAction& action) {
   return stream.str();
 }
 
+std::wstring BurstLabel(const MacroAction& action) {
+  if (action.kind != ActionKind::Burst) {
+    return L"";
+  }
+  std::wstringstream stream;
+  stream << action.count << L" x " << KindLabel(action.button);
+  if (action.interval > 0.0) {
+    stream << L" @ " << std::fixed << std::setprecision(0) << 1.0 / action.interval << L"/s";
+  } else {
+    stream << L" @ max";
+  }
+  return stream.str();
+}
+
+std::wstring CallLabel(const MacroAction& action, const BlockTable& blocks) {
+  if (action.kind != ActionKind::Call) {
+    return L"";
+  }
+  std::wstringstream stream;
+  stream << L"block " << winrt::to_hstring(action.block.substr(0, 8)).c_str();
+  auto found = blocks.find(action.block);
+  if (found != blocks.end()) {
+    stream << L" (" << found->second->size() << L" steps)";
+  } else {
+    stream << L" (missing)";
+  }
+  if (action.repeat > 1) {
+    stream << L" x " << action.repeat;
+  }
+  return stream.str();
+}
+
+std::wstring FormatClock(double seconds) {
+  auto total = static_cast<long long>(std::max(0.0, seconds) + 0.5);
+  std::wstringstream stream;
+  stream << total / 60 << L":" << std::setw(2) << std::setfill(L'0') << total % 60;
+  return stream.str();
+}
+
+int ClampCount(double value, int minimum, int maximum) {
+  // Written so NaN fails both comparisons and lands on minimum; the cast only sees in-range values.
+  if (!(value > minimum)) {
+    return minimum;
+  }
+  if (value >= maximum) {
+    return maximum;
+  }
+  return static_cast<int>(value);
+}
+
+double StepDuration(const MacroAction& action, const BlockTable* blocks) {
+  DurationMemo memo;
+  return StepDurationAtDepth(action, blocks, memo, 0);
+}
+
 std::wstring FormatDelay(double delaySeconds) {
   std::wstringstream stream;
   stream << std::fixed << std::setprecision(2) << delaySeconds << L"s";
   return stream.str();
 }
 
+MacroAction ActionFromJsonObject(const JsonObject& item) {
+  MacroAction action{};
+  auto id = winrt::to_string(item.GetNamedString(L"id", L""));
+  action.id = id.empty() ? GenerateGuidString() : id;
+  action.delay = item.GetNamedNumber(L"delay", 0.0);
+  action.x = item.GetNamedNumber(L"x", 0.0);
+  action.y = item.GetNamedNumber(L"y", 0.0);
+  auto kindValue = winrt::to_string(item.GetNamedString(L"kind", L"wait"));
+  action.kind = KindFromString(kindValue);
+  if (action.kind == ActionKind::Burst) {
+    auto buttonValue = winrt::to_string(item.GetNamedString(L"button", L"leftClick"));
+    action.button = KindFromString(buttonValue);
+    if (action.button == ActionKind::Wait || action.button == ActionKind::Burst) {
+      action.button = ActionKind::LeftClick;
+    }
+    action.count = ClampCount(item.GetNamedNumber(L"count", 0.0), 0, kMaxBurstCount);
+    action.interval = item.GetNamedNumber(L"interval", 0.0);
+  }
+  if (action.kind == ActionKind::Call) {
+    action.block = winrt::to_string(item.GetNamedString(L"block", L""));
+    action.repeat = ClampCount(item.GetNamedNumber(L"repeat", 1.0), 1, kMaxCallRepeat);
+  }
+  return action;
+}
+
 std::vector<MacroAction> ParseActionsFromJson(const JsonArray& array) {
+  TRACE_ZONE("ParseActionsFromJson");
   std::vector<MacroAction> actions;
   actions.reserve(array.Size());
   for (uint32_t i = 0; i < array.Size(); ++i) {
-    auto item = array.GetObjectAt(i);
-    MacroAction action{};
-    auto id = winrt::to_string(item.GetNamedString(L"id", L""));
-    action.id = id.empty() ? GenerateGuidString() : id;
-    action.delay = item.GetNamedNumber(L"delay", 0.0);
-    action.x = item.GetNamedNumber(L"x", 0.0);
-    action.y = item.GetNamedNumber(L"y", 0.0);
-    auto kindValue = winrt::to_string(item.GetNamedString(L"kind", L"wait"));
-    action.kind = KindFromString(kindValue);
-    actions.push_back(action);
+    actions.push_back(ActionFromJsonObject(array.GetObjectAt(i)));
   }
   return actions;
 }
 
 JsonArray SerializeActionsToJson(const std::vector<MacroAction>& actions) {
+  TRACE_ZONE("SerializeActionsToJson");
   JsonArray array;
   for (const auto& action : actions) {
     JsonObject obj;
@@ -105,7 +281,91 @@ JsonArray SerializeActionsToJson(const std::vector<MacroAction>& actions) {
     obj.SetNamedValue(L"x", winrt::Windows::Data::Json::JsonValue::CreateNumberValue(action.x));
     obj.SetNamedValue(L"y", winrt::Windows::Data::Json::JsonValue::CreateNumberValue(action.y));
     obj.SetNamedValue(L"kind", winrt::Windows::Data::Json::JsonValue::CreateStringValue(winrt::to_hstring(KindToString(action.kind))));
+    if (action.kind == ActionKind::Burst) {
+      obj.SetNamedValue(L"button", winrt::Windows::Data::Json::JsonValue::CreateStringValue(winrt::to_hstring(KindToString(action.button))));
+      obj.SetNamedValue(L"count", winrt::Windows::Data::Json::JsonValue::CreateNumberValue(action.count));
+      obj.SetNamedValue(L"interval", winrt::Windows::Data::Json::JsonValue::CreateNumberValue(action.interval));
+    }
+    if (action.kind == ActionKind::Call) {
+      obj.SetNamedValue(L"block", winrt::Windows::Data::Json::JsonValue::CreateStringValue(winrt::to_hstring(action.block)));
+      obj.SetNamedValue(L"repeat", winrt::Windows::Data::Json::JsonValue::CreateNumberValue(action.repeat));
+    }
     array.Append(obj);
   }
   return array;
 }
+
+BlockTable ParseBlocksFromJson(const JsonObject& object) {
+  BlockTable blocks;
+  for (auto&& pair : object) {
+    blocks.emplace(winrt::to_string(pair.Key()),
+                   std::make_shared<const std::vector<MacroAction>>(ParseActionsFromJson(pair.Value().GetArray())));
+  }
+  return blocks;
+}
+
+bool CallGraphIsBounded(const BlockTable& blocks) {
+  std::unordered_map<std::string, int> height;
+  for (const auto& [id, block] : blocks) {
+    if (BlockHeight(id, blocks, height, 0) > kMaxCallDepth) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ParseMacroDocument(const winrt::hstring& text, MacroDocument& document) {
+  try {
+    JsonValue root = JsonValue::Parse(text);
+    if (root.ValueType() == JsonValueType::Array) {
+      document.steps = ParseActionsFromJson(root.GetArray());
+      document.blocks.clear();
+      return true;
+    }
+    JsonObject obj = root.GetObject();
+    document.steps = ParseActionsFromJson(obj.GetNamedArray(L"steps"));
+    document.blocks = obj.HasKey(L"blocks") ? ParseBlocksFromJson(obj.GetNamedObject(L"blocks")) : BlockTable{};
+    return CallGraphIsBounded(document.blocks);
+  } catch (...) {
+    return false;
+  }
+}
+
+winrt::hstring SerializeMacroDocument(const std::vector<MacroAction>& steps, const BlockTable& blocks) {
+  JsonArray stepsArray = SerializeActionsToJson(steps);
+  std::vector<std::string> referenced;
+  CollectReferencedBlocks(steps, blocks, referenced, 0);
+  if (referenced.empty()) {
+    return stepsArray.Stringify();
+  }
+
+  JsonObject blocksObject;
+  for (const auto& key : referenced) {
+    blocksObject.SetNamedValue(winrt::to_hstring(key), SerializeActionsToJson(*blocks.at(key)));
+  }
+  JsonObject root;
+  root.SetNamedValue(L"blocks", blocksObject);
+  root.SetNamedValue(L"steps", stepsArray);
+  return root.Stringify();
+}
+
+bool ReadMacroFromFile(const std::wstring& path, MacroDocument& document) {
+  std::ifstream stream(std::filesystem::path(path), std::ios::binary);
+  if (!stream) {
+    return false;
+  }
+  std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  return ParseMacroDocument(winrt::to_hstring(text), document);
+}
+
+bool WriteMacroToFile(const std::wstring& path, const std::vector<MacroAction>& steps, const BlockTable& blocks) {
+  std::string text;
+  try {
+    text = winrt::to_string(SerializeMacroDocument(steps, blocks));
+  } catch (...) {
+    return false;
+  }
+  return WriteFileAtomically(path, [&text](std::ostream& stream) {
+    stream.write(text.data(), static_cast<std::streamsize>(text.size()));
+  });
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <winrt/Windows.Data.Json.h>
 
@@ -8,7 +10,9 @@ enum class ActionKind {
   LeftClick,
   RightClick,
   OtherClick,
-  Wait
+  Wait,
+  Burst,
+  Call
 };
 
 struct MacroAction {
@@ -17,14 +21,57 @@ struct MacroAction {
   double x = 0.0;
   double y = 0.0;
   ActionKind kind = ActionKind::Wait;
+  // Burst only: click button, number of clicks and seconds between clicks.
+  ActionKind button = ActionKind::LeftClick;
+  int count = 0;
+  double interval = 0.0;
+  // Call only: content hash of the shared block and how many times to run it.
+  std::string block;
+  int repeat = 1;
+};
+
+// Shared sub-macro blocks are immutable once built, so playback, the editor
+// and the service can all hold the same copy.
+using MacroBlock = std::shared_ptr<const std::vector<MacroAction>>;
+using BlockTable = std::unordered_map<std::string, MacroBlock>;
+
+// Deepest chain of nested blocks a document may contain. Loading rejects
+// deeper or cyclic chains; the walkers still stop here as a backstop.
+constexpr int kMaxCallDepth = 8;
+
+// Upper bounds for burst counts and call repeats read from files or typed in.
+constexpr int kMaxBurstCount = 10'000'000;
+constexpr int kMaxCallRepeat = 1'000'000;
+
+struct MacroDocument {
+  std::vector<MacroAction> steps;
+  BlockTable blocks;
 };
 
 std::string GenerateGuidString();
 std::string KindToString(ActionKind kind);
 ActionKind KindFromString(const std::string& value);
 std::wstring KindLabel(ActionKind kind);
+bool HasPosition(const MacroAction& action);
 std::wstring LocationLabel(const MacroAction& action);
+std::wstring BurstLabel(const MacroAction& action);
+std::wstring CallLabel(const MacroAction& action, const BlockTable& blocks);
 std::wstring FormatDelay(double delaySeconds);
+std::wstring FormatClock(double seconds);
+double StepDuration(const MacroAction& action, const BlockTable* blocks = nullptr);
+// Truncates a JSON or text number into [minimum, maximum]; NaN becomes minimum.
+int ClampCount(double value, int minimum, int maximum);
 
+MacroAction ActionFromJsonObject(const winrt::Windows::Data::Json::JsonObject& item);
 std::vector<MacroAction> ParseActionsFromJson(const winrt::Windows::Data::Json::JsonArray& array);
 winrt::Windows::Data::Json::JsonArray SerializeActionsToJson(const std::vector<MacroAction>& actions);
+BlockTable ParseBlocksFromJson(const winrt::Windows::Data::Json::JsonObject& object);
+// False when blocks call each other in a cycle or nest deeper than kMaxCallDepth.
+bool CallGraphIsBounded(const BlockTable& blocks);
+
+// Documents without blocks keep the original bare-array format; otherwise
+// they are written as {"blocks": {hash: [...]}, "steps": [...]}.
+bool ParseMacroDocument(const winrt::hstring& text, MacroDocument& document);
+winrt::hstring SerializeMacroDocument(const std::vector<MacroAction>& steps, const BlockTable& blocks);
+bool ReadMacroFromFile(const std::wstring& path, MacroDocument& document);
+bool WriteMacroToFile(const std::wstring& path, const std::vector<MacroAction>& steps, const BlockTable& blocks);
@@ -0,0 +1,426 @@
+#include "pch.h"
+#include "MacroBlocks.h"
+#include "MacroLibrary.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+namespace {
+constexpr uint64_t kRollingBase = 1099511628211ull;
+
+template <typename T>
+uint64_t HashValue(const T& value, uint64_t seed) {
+  return HashBytes(&value, sizeof(value), seed);
+}
+
+std::string BlockId(uint64_t hash) {
+  std::ostringstream stream;
+  stream << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return stream.str();
+}
+
+std::string BlockIdFor(const std::vector<MacroAction>& steps) {
+  std::vector<uint64_t> hashes(steps.size());
+  for (size_t i = 0; i < steps.size(); ++i) {
+    hashes[i] = StepContentHash(steps[i]);
+  }
+  return BlockId(HashBytes(hashes.data(), hashes.size() * sizeof(uint64_t)));
+}
+
+void CountBlockClicks(const std::string& id, const BlockTable& blocks, const ClickRegion& region,
+                      std::unordered_set<std::string>& visited, size_t& count) {
+  auto found = blocks.find(id);
+  if (found == blocks.end() || !visited.insert(id).second) {
+    return;
+  }
+  for (const auto& action : *found->second) {
+    if (action.kind == ActionKind::Call) {
+      CountBlockClicks(action.block, blocks, region, visited, count);
+    } else if (region.Contains(action)) {
+      ++count;
+    }
+  }
+}
+
+// Squared distance from (x, y) to the nearest click reachable through block id.
+// Each block is measured once; a block already on the stack counts as empty.
+double NearestInBlock(const std::string& id, const BlockTable& blocks, double x, double y,
+                      std::unordered_map<std::string, double>& memo, int depth) {
+  auto known = memo.find(id);
+  if (known != memo.end()) {
+    return known->second;
+  }
+  double best = std::numeric_limits<double>::infinity();
+  auto found = blocks.find(id);
+  if (found == blocks.end() || depth >= kMaxCallDepth) {
+    return best;
+  }
+  memo.emplace(id, best);
+  for (const auto& action : *found->second) {
+    if (action.kind == ActionKind::Call) {
+      best = std::min(best, NearestInBlock(action.block, blocks, x, y, memo, depth + 1));
+    } else if (HasPosition(action)) {
+      double dx = action.x - x;
+      double dy = action.y - y;
+      best = std::min(best, dx * dx + dy * dy);
+    }
+  }
+  memo[id] = best;
+  return best;
+}
+
+struct BlockTransform {
+  BlockTable& blocks;
+  const ClickRegion& region;
+  double scale;
+  double offsetX;
+  double offsetY;
+  // Old id to rewritten id; an entry is added before recursing so cycles end.
+  std::unordered_map<std::string, std::string> rewritten{};
+  size_t moved = 0;
+
+  std::string Rewrite(const std::string& id) {
+    auto done = rewritten.find(id);
+    if (done != rewritten.end()) {
+      return done->second;
+    }
+    rewritten.emplace(id, id);
+    auto found = blocks.find(id);
+    if (found == blocks.end()) {
+      return id;
+    }
+
+    MacroBlock original = found->second;
+    std::vector<MacroAction> copy = *original;
+    bool changed = false;
+    for (auto& action : copy) {
+      if (action.kind == ActionKind::Call) {
+        std::string target = Rewrite(action.block);
+        if (target != action.block) {
+          action.block = std::move(target);
+          changed = true;
+        }
+      } else if (region.Contains(action)) {
+        action.x = action.x * scale + offsetX;
+        action.y = action.y * scale + offsetY;
+        ++moved;
+        changed = true;
+      }
+    }
+    if (!changed) {
+      return id;
+    }
+    std::string newId = BlockIdFor(copy);
+    blocks.emplace(newId, std::make_shared<const std::vector<MacroAction>>(std::move(copy)));
+    rewritten[id] = newId;
+    return newId;
+  }
+};
+
+size_t ExpandedCountAtDepth(const std::vector<MacroAction>& steps, const BlockTable& blocks,
+                            std::unordered_map<std::string, size_t>& memo, int depth) {
+  size_t count = 0;
+  for (const auto& action : steps) {
+    if (action.kind != ActionKind::Call) {
+      ++count;
+      continue;
+    }
+    auto found = blocks.find(action.block);
+    if (found == blocks.end() || depth >= kMaxCallDepth) {
+      continue;
+    }
+    auto known = memo.find(action.block);
+    if (known == memo.end()) {
+      known = memo.emplace(action.block, ExpandedCountAtDepth(*found->second, blocks, memo, depth + 1)).first;
+    }
+    count += known->second * static_cast<size_t>(action.repeat);
+  }
+  return count;
+}
+}  // namespace
+
+uint64_t StepContentHash(const MacroAction& action) {
+  uint64_t hash = HashValue(action.kind, 14695981039346656037ull);
+  hash = HashValue(action.delay, hash);
+  hash = HashValue(action.x, hash);
+  hash = HashValue(action.y, hash);
+  if (action.kind == ActionKind::Burst) {
+    hash = HashValue(action.button, hash);
+    hash = HashValue(action.count, hash);
+    hash = HashValue(action.interval, hash);
+  }
+  if (action.kind == ActionKind::Call) {
+    hash = HashBytes(action.block.data(), action.block.size(), hash);
+    hash = HashValue(action.repeat, hash);
+  }
+  return hash;
+}
+
+bool SameStepContent(const MacroAction& a, const MacroAction& b) {
+  if (a.kind != b.kind || a.delay != b.delay || a.x != b.x || a.y != b.y) {
+    return false;
+  }
+  if (a.kind == ActionKind::Burst && (a.button != b.button || a.count != b.count || a.interval != b.interval)) {
+    return false;
+  }
+  if (a.kind == ActionKind::Call && (a.block != b.block || a.repeat != b.repeat)) {
+    return false;
+  }
+  return true;
+}
+
+size_t ExpandedStepCount(const std::vector<MacroAction>& steps, const BlockTable& blocks) {
+  std::unordered_map<std::string, size_t> memo;
+  return ExpandedCountAtDepth(steps, blocks, memo, 0);
+}
+
+size_t ResidentStepCount(const MacroDocument& document) {
+  size_t count = document.steps.size();
+  for (const auto& [id, block] : document.blocks) {
+    count += block->size();
+  }
+  return count;
+}
+
+DedupStats DeduplicateBlocks(MacroDocument& document, size_t minRun, size_t maxRun) {
+  TRACE_ZONE("DeduplicateBlocks");
+  DedupStats stats{};
+  stats.stepsBefore = ResidentStepCount(document);
+  auto& steps = document.steps;
+  const size_t count = steps.size();
+  if (count < minRun * 2) {
+    stats.stepsAfter = stats.stepsBefore;
+    return stats;
+  }
+
+  std::vector<uint64_t> stepHashes(count);
+  for (size_t i = 0; i < count; ++i) {
+    stepHashes[i] = StepContentHash(steps[i]);
+  }
+
+  // prefix[i] is the polynomial hash of steps [0, i), so any window hash is
+  // prefix[end] - prefix[start] * base^length in wrapping 64-bit arithmetic.
+  std::vector<uint64_t> prefix(count + 1, 0);
+  for (size_t i = 0; i < count; ++i) {
+    prefix[i + 1] = prefix[i] * kRollingBase + stepHashes[i];
+  }
+
+  // Existing Calls stay where they are; nesting blocks inside new blocks is not worth the bookkeeping.
+  std::vector<char> claimed(count, 0);
+  for (size_t i = 0; i < count; ++i) {
+    claimed[i] = steps[i].kind == ActionKind::Call ? 1 : 0;
+  }
+
+  struct Candidate {
+    size_t length = 0;
+    size_t savings = 0;
+    std::vector<size_t> starts{};
+  };
+  auto savingsFor = [](size_t occurrences, size_t length) -> size_t {
+    // Calls plus one copy of the block must beat the inline steps.
+    size_t inlineSteps = occurrences * length;
+    return (occurrences < 2 || inlineSteps <= occurrences + length) ? 0 : inlineSteps - occurrences - length;
+  };
+
+  std::vector<Candidate> candidates;
+  // (window hash, start) pairs; sorting groups equal windows with their starts ascending.
+  std::vector<std::pair<uint64_t, uint32_t>> windows;
+  windows.reserve(count);
+  std::vector<char> repeats(count, 1);
+  maxRun = std::min(maxRun, count / 2);
+  for (size_t length = std::max<size_t>(minRun, 2); length <= maxRun; ++length) {
+    uint64_t power = 1;
+    for (size_t i = 0; i < length; ++i) {
+      power *= kRollingBase;
+    }
+
+    // Sliding count of existing Calls so each window is checked in O(1).
+    windows.clear();
+    size_t blocked = 0;
+    for (size_t i = 0; i < length; ++i) {
+      blocked += claimed[i];
+    }
+    for (size_t start = 0; start + length <= count; ++start) {
+      if (start > 0) {
+        blocked += claimed[start + length - 1];
+        blocked -= claimed[start - 1];
+      }
+      if (blocked == 0 && repeats[start]) {
+        windows.emplace_back(prefix[start + length] - prefix[start] * power, static_cast<uint32_t>(start));
+      }
+    }
+    std::sort(windows.begin(), windows.end());
+    // A window can only repeat if its one-step-shorter prefix did, so unique starts drop out for good.
+    std::fill(repeats.begin(), repeats.end(), 0);
+
+    for (size_t group = 0; group < windows.size();) {
+      size_t end = group + 1;
+      while (end < windows.size() && windows[end].first == windows[group].first) {
+        ++end;
+      }
+      for (size_t i = group; i < end && end - group > 1; ++i) {
+        repeats[windows[i].second] = 1;
+      }
+      // A greedy sweep over the ascending starts gives the non-overlapping occurrences.
+      // Content is only compared once a candidate is actually taken.
+      Candidate candidate{};
+      candidate.length = length;
+      for (size_t i = group; i < end && end - group > 1; ++i) {
+        if (candidate.starts.empty() || windows[i].second >= candidate.starts.back() + length) {
+          candidate.starts.push_back(windows[i].second);
+        }
+      }
+      candidate.savings = savingsFor(candidate.starts.size(), length);
+      if (candidate.savings > 0) {
+        candidates.push_back(std::move(candidate));
+      }
+      group = end;
+    }
+  }
+
+  // Take the runs that save the most first. Overlaps with runs already taken
+  // drop out, so a candidate may shrink below break-even and be skipped.
+  std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+    return a.savings != b.savings ? a.savings > b.savings : a.length > b.length;
+  });
+  std::vector<std::string> callAt(count);
+  for (auto& candidate : candidates) {
+    const size_t length = candidate.length;
+    std::vector<size_t> free;
+    for (size_t start : candidate.starts) {
+      if (std::none_of(claimed.begin() + start, claimed.begin() + start + length, [](char c) { return c != 0; })) {
+        free.push_back(start);
+      }
+    }
+    if (savingsFor(free.size(), length) == 0) {
+      continue;
+    }
+    // Drops any window that only matched through a hash collision.
+    const size_t first = free.front();
+    free.erase(std::remove_if(free.begin() + 1, free.end(),
+                              [&](size_t start) {
+                                for (size_t k = 0; k < length; ++k) {
+                                  if (!SameStepContent(steps[first + k], steps[start + k])) {
+                                    return true;
+                                  }
+                                }
+                                return false;
+                              }),
+               free.end());
+    if (savingsFor(free.size(), length) == 0) {
+      continue;
+    }
+
+    std::string id = BlockId(HashBytes(&stepHashes[first], length * sizeof(uint64_t)));
+    if (document.blocks.find(id) == document.blocks.end()) {
+      document.blocks.emplace(id, std::make_shared<const std::vector<MacroAction>>(steps.begin() + first,
+                                                                                  steps.begin() + first + length));
+      ++stats.blocksCreated;
+    }
+    for (size_t start : free) {
+      std::fill(claimed.begin() + start, claimed.begin() + start + length, 1);
+      callAt[start] = id;
+    }
+  }
+
+  std::vector<MacroAction> rewritten;
+  rewritten.reserve(count);
+  for (size_t i = 0; i < count;) {
+    if (callAt[i].empty()) {
+      rewritten.push_back(std::move(steps[i]));
+      ++i;
+      continue;
+    }
+    const size_t length = document.blocks.at(callAt[i])->size();
+    // New calls carry no delay of their own, so folding one into the previous call keeps the timing.
+    if (!rewritten.empty() && rewritten.back().kind == ActionKind::Call && rewritten.back().block == callAt[i]) {
+      ++rewritten.back().repeat;
+    } else {
+      MacroAction call{};
+      call.id = GenerateGuidString();
+      call.kind = ActionKind::Call;
+      call.block = callAt[i];
+      call.repeat = 1;
+      rewritten.push_back(std::move(call));
+      ++stats.callsInserted;
+    }
+    i += length;
+  }
+  steps = std::move(rewritten);
+  stats.stepsAfter = ResidentStepCount(document);
+  return stats;
+}
+
+std::vector<MacroAction> InlineCall(const MacroAction& call, const BlockTable& blocks) {
+  std::vector<MacroAction> steps;
+  auto found = blocks.find(call.block);
+  if (call.kind != ActionKind::Call || found == blocks.end()) {
+    return steps;
+  }
+  const auto& block = *found->second;
+  steps.reserve(block.size() * static_cast<size_t>(std::max(1, call.repeat)));
+  for (int i = 0; i < std::max(1, call.repeat); ++i) {
+    for (const auto& inner : block) {
+      steps.push_back(inner);
+      steps.back().id = GenerateGuidString();
+    }
+  }
+  if (!steps.empty()) {
+    steps.front().delay += call.delay;
+  }
+  return steps;
+}
+
+bool NearestBlockClick(const std::vector<MacroAction>& steps, const BlockTable& blocks, double x, double y,
+                       size_t& callIndex, double& distanceSquared) {
+  TRACE_ZONE("NearestBlockClick");
+  std::unordered_map<std::string, double> memo;
+  bool found = false;
+  for (size_t i = 0; i < steps.size(); ++i) {
+    if (steps[i].kind != ActionKind::Call) {
+      continue;
+    }
+    double distance = NearestInBlock(steps[i].block, blocks, x, y, memo, 0);
+    if (distance < std::numeric_limits<double>::infinity() && (!found || distance < distanceSquared)) {
+      callIndex = i;
+      distanceSquared = distance;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool ClickRegion::Contains(const MacroAction& action) const {
+  return HasPosition(action) && action.x >= std::min(left, right) && action.x <= std::max(left, right) &&
+         action.y >= std::min(top, bottom) && action.y <= std::max(top, bottom);
+}
+
+size_t CountBlockClicksInRegion(const std::vector<MacroAction>& steps, const BlockTable& blocks,
+                                const ClickRegion& region) {
+  std::unordered_set<std::string> visited;
+  size_t count = 0;
+  for (const auto& action : steps) {
+    if (action.kind == ActionKind::Call) {
+      CountBlockClicks(action.block, blocks, region, visited, count);
+    }
+  }
+  return count;
+}
+
+size_t TransformBlockClicks(std::vector<MacroAction>& steps, BlockTable& blocks, const ClickRegion& region, double dx,
+                            double dy, double scale, double originX, double originY) {
+  TRACE_ZONE("TransformBlockClicks");
+  BlockTransform transform{blocks, region, scale, originX - originX * scale + dx, originY - originY * scale + dy};
+  for (auto& action : steps) {
+    if (action.kind == ActionKind::Call) {
+      action.block = transform.Rewrite(action.block);
+    }
+  }
+  return transform.moved;
+}
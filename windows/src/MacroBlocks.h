@@ -0,0 +1,57 @@
+#pragma once
+
+#include "MacroAction.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct DedupStats {
+  size_t blocksCreated = 0;
+  size_t callsInserted = 0;
+  // Resident steps: top-level steps plus one copy of every block's steps.
+  size_t stepsBefore = 0;
+  size_t stepsAfter = 0;
+};
+
+// Hash of everything that affects playback; the step id is deliberately left out.
+uint64_t StepContentHash(const MacroAction& action);
+bool SameStepContent(const MacroAction& a, const MacroAction& b);
+// Number of steps playback will actually execute once every Call is expanded.
+size_t ExpandedStepCount(const std::vector<MacroAction>& steps, const BlockTable& blocks);
+size_t ResidentStepCount(const MacroDocument& document);
+
+// Finds runs of identical steps that repeat at least twice and moves each one
+// into a shared, content-addressed block, replacing every occurrence with a
+// Call. Longer runs are extracted first; back-to-back calls to the same block
+// collapse into a single Call with a repeat count.
+DedupStats DeduplicateBlocks(MacroDocument& document, size_t minRun = 4, size_t maxRun = 64);
+
+// The steps a Call plays, repeated, with the Call's delay folded into the
+// first one and fresh step ids. Nested Calls stay Calls. Empty if the block is missing.
+std::vector<MacroAction> InlineCall(const MacroAction& call, const BlockTable& blocks);
+
+struct ClickRegion {
+  double left = 0.0;
+  double top = 0.0;
+  double right = 0.0;
+  double bottom = 0.0;
+
+  bool Contains(const MacroAction& action) const;
+};
+
+// Clicks inside blocks reachable from steps that fall in the region, each block counted once.
+size_t CountBlockClicksInRegion(const std::vector<MacroAction>& steps, const BlockTable& blocks,
+                                const ClickRegion& region);
+// Nearest click inside any block reachable from steps. The spatial index only
+// holds top-level clicks, so this reports the top-level Call that plays the
+// match and its squared distance. False when no block holds a click.
+bool NearestBlockClick(const std::vector<MacroAction>& steps, const BlockTable& blocks, double x, double y,
+                       size_t& callIndex, double& distanceSquared);
+// Applies origin + (p - origin) * scale + offset to every block click in the
+// region. Blocks are immutable and may be shared, so each affected block is
+// copied under its new content hash and the Calls that reach it (top-level or
+// nested) are retargeted; the originals stay in the table. Returns the number
+// of block steps moved.
+size_t TransformBlockClicks(std::vector<MacroAction>& steps, BlockTable& blocks, const ClickRegion& region, double dx,
+                            double dy, double scale, double originX, double originY);
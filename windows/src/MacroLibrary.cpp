@@ -0,0 +1,353 @@
+#include "pch.h"
+#include "MacroLibrary.h"
+#include "MacroBlocks.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+
+using winrt::Windows::Data::Json::JsonArray;
+using winrt::Windows::Data::Json::JsonObject;
+using winrt::Windows::Data::Json::JsonValue;
+
+namespace {
+constexpr wchar_t kMacroExtension[] = L".emacro";
+
+MacroMetadata ParseMetadata(const std::wstring& path, int64_t modifiedTime, uint64_t fileSize) {
+  TRACE_ZONE("ParseMetadata");
+  MacroMetadata metadata{};
+  MacroDocument document;
+  if (ReadMacroFromFile(path, document)) {
+    metadata = ComputeMetadata(document.steps, &document.blocks);
+    metadata.valid = true;
+  }
+  metadata.path = path;
+  metadata.modifiedTime = modifiedTime;
+  metadata.fileSize = fileSize;
+  return metadata;
+}
+
+// Bounds and kinds do not depend on how often a block runs, so each block is visited once.
+void AccumulateBounds(MacroMetadata& metadata, const std::vector<MacroAction>& actions, const BlockTable* blocks,
+                      std::unordered_set<std::string>& visited, int depth) {
+  for (const auto& action : actions) {
+    metadata.kindMask |= KindBit(action.kind);
+    if (action.kind == ActionKind::Call) {
+      if (blocks && depth < kMaxCallDepth && visited.insert(action.block).second) {
+        auto found = blocks->find(action.block);
+        if (found != blocks->end()) {
+          AccumulateBounds(metadata, *found->second, blocks, visited, depth + 1);
+        }
+      }
+      continue;
+    }
+    if (action.kind == ActionKind::Wait) {
+      continue;
+    }
+    if (!metadata.hasClicks) {
+      metadata.minX = metadata.maxX = action.x;
+      metadata.minY = metadata.maxY = action.y;
+      metadata.hasClicks = true;
+      continue;
+    }
+    metadata.minX = std::min(metadata.minX, action.x);
+    metadata.minY = std::min(metadata.minY, action.y);
+    metadata.maxX = std::max(metadata.maxX, action.x);
+    metadata.maxY = std::max(metadata.maxY, action.y);
+  }
+}
+
+JsonObject MetadataToJson(const MacroMetadata& metadata) {
+  JsonObject obj;
+  obj.SetNamedValue(L"path", JsonValue::CreateStringValue(metadata.path));
+  // Times and sizes are stored as strings so 64-bit values survive the double round trip.
+  obj.SetNamedValue(L"mtime", JsonValue::CreateStringValue(std::to_wstring(metadata.modifiedTime)));
+  obj.SetNamedValue(L"size", JsonValue::CreateStringValue(std::to_wstring(metadata.fileSize)));
+  obj.SetNamedValue(L"valid", JsonValue::CreateBooleanValue(metadata.valid));
+  obj.SetNamedValue(L"steps", JsonValue::CreateNumberValue(static_cast<double>(metadata.stepCount)));
+  obj.SetNamedValue(L"duration", JsonValue::CreateNumberValue(metadata.totalDuration));
+  obj.SetNamedValue(L"kinds", JsonValue::CreateNumberValue(metadata.kindMask));
+  obj.SetNamedValue(L"hasClicks", JsonValue::CreateBooleanValue(metadata.hasClicks));
+  obj.SetNamedValue(L"minX", JsonValue::CreateNumberValue(metadata.minX));
+  obj.SetNamedValue(L"minY", JsonValue::CreateNumberValue(metadata.minY));
+  obj.SetNamedValue(L"maxX", JsonValue::CreateNumberValue(metadata.maxX));
+  obj.SetNamedValue(L"maxY", JsonValue::CreateNumberValue(metadata.maxY));
+  return obj;
+}
+
+MacroMetadata MetadataFromJson(const JsonObject& obj) {
+  MacroMetadata metadata{};
+  metadata.path = obj.GetNamedString(L"path", L"").c_str();
+  metadata.modifiedTime = std::stoll(std::wstring(obj.GetNamedString(L"mtime", L"0")));
+  metadata.fileSize = std::stoull(std::wstring(obj.GetNamedString(L"size", L"0")));
+  metadata.valid = obj.GetNamedBoolean(L"valid", false);
+  metadata.stepCount = static_cast<size_t>(obj.GetNamedNumber(L"steps", 0.0));
+  metadata.totalDuration = obj.GetNamedNumber(L"duration", 0.0);
+  metadata.kindMask = static_cast<uint32_t>(obj.GetNamedNumber(L"kinds", 0.0));
+  metadata.hasClicks = obj.GetNamedBoolean(L"hasClicks", false);
+  metadata.minX = obj.GetNamedNumber(L"minX", 0.0);
+  metadata.minY = obj.GetNamedNumber(L"minY", 0.0);
+  metadata.maxX = obj.GetNamedNumber(L"maxX", 0.0);
+  metadata.maxY = obj.GetNamedNumber(L"maxY", 0.0);
+  return metadata;
+}
+}  // namespace
+
+std::wstring AppDataDirectory() {
+  wchar_t buffer[MAX_PATH]{};
+  DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, static_cast<DWORD>(std::size(buffer)));
+  std::filesystem::path root = (length > 0 && length < std::size(buffer))
+                                   ? std::filesystem::path(buffer)
+                                   : std::filesystem::temp_directory_path();
+  root /= L"EasyMacro";
+  std::error_code ec;
+  std::filesystem::create_directories(root, ec);
+  return root.wstring();
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed) {
+  const auto* bytes = static_cast<const unsigned char*>(data);
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool StatFile(const std::wstring& path, int64_t& modifiedTime, uint64_t& fileSize) {
+  std::error_code ec;
+  auto time = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    return false;
+  }
+  auto size = std::filesystem::file_size(path, ec);
+  if (ec) {
+    return false;
+  }
+  modifiedTime = static_cast<int64_t>(time.time_since_epoch().count());
+  fileSize = static_cast<uint64_t>(size);
+  return true;
+}
+
+bool WriteFileAtomically(const std::wstring& path, const std::function<void(std::ostream&)>& write) {
+  std::wstring temporary = path + L"." + std::to_wstring(GetCurrentThreadId()) + L".tmp";
+  bool written = false;
+  {
+    std::ofstream stream(std::filesystem::path(temporary), std::ios::binary | std::ios::trunc);
+    if (stream) {
+      write(stream);
+      stream.close();
+      written = static_cast<bool>(stream);
+    }
+  }
+  if (written && MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    return true;
+  }
+  std::error_code ec;
+  std::filesystem::remove(temporary, ec);
+  return false;
+}
+
+uint32_t KindBit(ActionKind kind) {
+  return 1u << static_cast<uint32_t>(kind);
+}
+
+MacroMetadata ComputeMetadata(const std::vector<MacroAction>& actions, const BlockTable* blocks) {
+  MacroMetadata metadata{};
+  metadata.stepCount = blocks ? ExpandedStepCount(actions, *blocks) : actions.size();
+  for (const auto& action : actions) {
+    metadata.totalDuration += StepDuration(action, blocks);
+  }
+  std::unordered_set<std::string> visited;
+  AccumulateBounds(metadata, actions, blocks, visited, 0);
+  return metadata;
+}
+
+MacroLibrary::MacroLibrary(std::wstring folder) : m_folder(std::move(folder)) {
+  LoadIndex();
+}
+
+std::vector<std::wstring> MacroLibrary::ListMacroFiles() const {
+  std::vector<std::wstring> files;
+  std::error_code ec;
+  auto options = std::filesystem::directory_options::skip_permission_denied;
+  for (std::filesystem::recursive_directory_iterator it(m_folder, options, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (it->is_regular_file(ec) && it->path().extension() == kMacroExtension) {
+      files.push_back(it->path().wstring());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+std::wstring MacroLibrary::IndexPath() const {
+  uint64_t key = HashBytes(m_folder.data(), m_folder.size() * sizeof(wchar_t));
+  std::wstringstream name;
+  name << std::hex << key << L".json";
+  std::filesystem::path path = AppDataDirectory();
+  path /= L"index";
+  std::error_code ec;
+  std::filesystem::create_directories(path, ec);
+  return (path / name.str()).wstring();
+}
+
+void MacroLibrary::LoadIndex() {
+  std::ifstream stream(std::filesystem::path(IndexPath()), std::ios::binary);
+  if (!stream) {
+    return;
+  }
+  std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  try {
+    JsonArray array = JsonArray::Parse(winrt::to_hstring(text));
+    for (uint32_t i = 0; i < array.Size(); ++i) {
+      auto metadata = MetadataFromJson(array.GetObjectAt(i));
+      m_cache[metadata.path] = std::move(metadata);
+    }
+  } catch (...) {
+    m_cache.clear();
+  }
+}
+
+void MacroLibrary::SaveIndex() const {
+  JsonArray array;
+  for (const auto& metadata : m_entries) {
+    array.Append(MetadataToJson(metadata));
+  }
+  auto text = winrt::to_string(array.Stringify());
+  WriteFileAtomically(IndexPath(), [&text](std::ostream& stream) {
+    stream.write(text.data(), static_cast<std::streamsize>(text.size()));
+  });
+}
+
+std::vector<MacroMetadata> MacroLibrary::ScanFiles(const std::vector<std::wstring>& files, size_t threadCount,
+                                                   bool useCache, std::vector<char>& reparsed) const {
+  std::vector<MacroMetadata> entries(files.size());
+  reparsed.assign(files.size(), 0);
+  {
+    ThreadPool pool(threadCount);
+    for (size_t i = 0; i < files.size(); ++i) {
+      const MacroMetadata* cached = nullptr;
+      auto found = useCache ? m_cache.find(files[i]) : m_cache.end();
+      if (found != m_cache.end()) {
+        cached = &found->second;
+      }
+      pool.Submit([&files, &entries, &reparsed, cached, i]() {
+        int64_t modifiedTime = 0;
+        uint64_t fileSize = 0;
+        StatFile(files[i], modifiedTime, fileSize);
+        if (cached && cached->modifiedTime == modifiedTime && cached->fileSize == fileSize) {
+          entries[i] = *cached;
+          return;
+        }
+        entries[i] = ParseMetadata(files[i], modifiedTime, fileSize);
+        reparsed[i] = 1;
+      });
+    }
+    pool.WaitIdle();
+  }
+  return entries;
+}
+
+ScanResult MacroLibrary::Scan(size_t threadCount) {
+  auto start = std::chrono::steady_clock::now();
+  auto files = ListMacroFiles();
+  std::vector<char> reparsed;
+  auto entries = ScanFiles(files, threadCount, true, reparsed);
+
+  ScanResult result{};
+  result.total = entries.size();
+  const size_t previousCount = m_cache.size();
+  m_cache.clear();
+  for (size_t i = 0; i < entries.size(); ++i) {
+    result.reparsed += reparsed[i];
+    result.invalid += entries[i].valid ? 0 : 1;
+    m_cache[entries[i].path] = entries[i];
+  }
+  m_entries = std::move(entries);
+  if (result.reparsed > 0 || m_entries.size() != previousCount) {
+    SaveIndex();
+  }
+
+  result.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+std::vector<ScanThroughput> MacroLibrary::BenchmarkScan() const {
+  TRACE_ZONE("BenchmarkScan");
+  auto files = ListMacroFiles();
+  const size_t maxThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  std::vector<char> reparsed;
+  // One unmeasured pass first, so every thread count reads from the same OS file cache.
+  ScanFiles(files, maxThreads, false, reparsed);
+
+  std::vector<ScanThroughput> results;
+  for (size_t threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+    auto start = std::chrono::steady_clock::now();
+    ScanFiles(files, threads, false, reparsed);
+    ScanThroughput run{};
+    run.threads = threads;
+    run.files = files.size();
+    run.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    run.filesPerSecond = run.elapsedSeconds > 0.0 ? static_cast<double>(run.files) / run.elapsedSeconds : 0.0;
+    results.push_back(run);
+    if (threads == maxThreads) {
+      break;
+    }
+  }
+  return results;
+}
+
+BatchResult MacroLibrary::RunBatch(BatchMode mode, size_t threadCount) const {
+  auto files = ListMacroFiles();
+  std::vector<char> ok(files.size(), 0);
+  std::vector<DedupStats> dedup(mode == BatchMode::Deduplicate ? files.size() : 0);
+  std::vector<uint64_t> bytesBefore(dedup.size(), 0);
+  std::vector<uint64_t> bytesAfter(dedup.size(), 0);
+  {
+    ThreadPool pool(threadCount);
+    for (size_t i = 0; i < files.size(); ++i) {
+      pool.Submit([&, mode, i]() {
+        MacroDocument document;
+        if (!ReadMacroFromFile(files[i], document)) {
+          return;
+        }
+        if (mode == BatchMode::Normalize && !WriteMacroToFile(files[i], document.steps, document.blocks)) {
+          return;
+        }
+        if (mode == BatchMode::Deduplicate) {
+          bytesBefore[i] = winrt::to_string(SerializeMacroDocument(document.steps, document.blocks)).size();
+          dedup[i] = DeduplicateBlocks(document);
+          bytesAfter[i] = winrt::to_string(SerializeMacroDocument(document.steps, document.blocks)).size();
+        }
+        ok[i] = 1;
+      });
+    }
+    pool.WaitIdle();
+  }
+
+  BatchResult result{};
+  result.processed = files.size();
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!ok[i]) {
+      ++result.failed;
+      result.failures.push_back(files[i]);
+      continue;
+    }
+    if (mode == BatchMode::Deduplicate) {
+      result.bytesBefore += bytesBefore[i];
+      result.bytesAfter += bytesAfter[i];
+      result.stepsBefore += dedup[i].stepsBefore;
+      result.stepsAfter += dedup[i].stepsAfter;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "MacroAction.h"
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct MacroMetadata {
+  std::wstring path;
+  int64_t modifiedTime = 0;
+  uint64_t fileSize = 0;
+  bool valid = false;
+  size_t stepCount = 0;
+  double totalDuration = 0.0;
+  uint32_t kindMask = 0;
+  bool hasClicks = false;
+  double minX = 0.0;
+  double minY = 0.0;
+  double maxX = 0.0;
+  double maxY = 0.0;
+};
+
+enum class BatchMode {
+  Validate,
+  Normalize,
+  // Read-only: measures what block deduplication would save without rewriting files.
+  Deduplicate
+};
+
+struct BatchResult {
+  size_t processed = 0;
+  size_t failed = 0;
+  std::vector<std::wstring> failures{};
+  uint64_t bytesBefore = 0;
+  uint64_t bytesAfter = 0;
+  uint64_t stepsBefore = 0;
+  uint64_t stepsAfter = 0;
+};
+
+struct ScanResult {
+  size_t total = 0;
+  size_t reparsed = 0;
+  size_t invalid = 0;
+  double elapsedSeconds = 0.0;
+};
+
+struct ScanThroughput {
+  size_t threads = 0;
+  size_t files = 0;
+  double elapsedSeconds = 0.0;
+  double filesPerSecond = 0.0;
+};
+
+std::wstring AppDataDirectory();
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+bool StatFile(const std::wstring& path, int64_t& modifiedTime, uint64_t& fileSize);
+// Writes through a temporary file beside path and renames it over path, so
+// readers never see a partial file and a failed write keeps the old one. The
+// temporary name is unique per thread; it is deleted on every failure.
+bool WriteFileAtomically(const std::wstring& path, const std::function<void(std::ostream&)>& write);
+uint32_t KindBit(ActionKind kind);
+MacroMetadata ComputeMetadata(const std::vector<MacroAction>& actions, const BlockTable* blocks = nullptr);
+
+// Folder-wide view of .emacro files. Entries are cached on disk and only
+// re-parsed when a file's modification time or size differs from the index.
+class MacroLibrary {
+ public:
+  explicit MacroLibrary(std::wstring folder);
+
+  ScanResult Scan(size_t threadCount = 0);
+  // Cold scans that ignore the index at 1, 2, 4, ... hardware_concurrency
+  // threads. The index and entries are left untouched.
+  std::vector<ScanThroughput> BenchmarkScan() const;
+  BatchResult RunBatch(BatchMode mode, size_t threadCount = 0) const;
+
+  const std::vector<MacroMetadata>& Entries() const { return m_entries; }
+  const std::wstring& Folder() const { return m_folder; }
+
+ private:
+  std::vector<std::wstring> ListMacroFiles() const;
+  // Reads metadata for every file, reusing m_cache entries whose mtime and
+  // size still match when useCache is set. reparsed marks files that were read.
+  std::vector<MacroMetadata> ScanFiles(const std::vector<std::wstring>& files, size_t threadCount, bool useCache,
+                                       std::vector<char>& reparsed) const;
+  std::wstring IndexPath() const;
+  void LoadIndex();
+  void SaveIndex() const;
+
+  std::wstring m_folder{};
+  std::unordered_map<std::wstring, MacroMetadata> m_cache{};
+  std::vector<MacroMetadata> m_entries{};
+};
@@ -0,0 +1,146 @@
+#include "pch.h"
+#include "MacroPlayback.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+// Clicks sent per SendInput call when a burst has no interval.
+constexpr size_t kBurstBatchClicks = 512;
+// Longest single timer wait, so a stop request ends a slow burst promptly.
+constexpr int64_t kStopCheckMillis = 5;
+
+void ClickFlags(ActionKind button, DWORD& downFlag, DWORD& upFlag) {
+  downFlag = MOUSEEVENTF_LEFTDOWN;
+  upFlag = MOUSEEVENTF_LEFTUP;
+  if (button == ActionKind::RightClick) {
+    downFlag = MOUSEEVENTF_RIGHTDOWN;
+    upFlag = MOUSEEVENTF_RIGHTUP;
+  } else if (button == ActionKind::OtherClick) {
+    downFlag = MOUSEEVENTF_MIDDLEDOWN;
+    upFlag = MOUSEEVENTF_MIDDLEUP;
+  }
+}
+
+void FillClicks(std::vector<INPUT>& inputs, ActionKind button) {
+  DWORD downFlag = 0;
+  DWORD upFlag = 0;
+  ClickFlags(button, downFlag, upFlag);
+  for (size_t i = 0; i < inputs.size(); i += 2) {
+    inputs[i] = {};
+    inputs[i].type = INPUT_MOUSE;
+    inputs[i].mi.dwFlags = downFlag;
+    inputs[i + 1] = {};
+    inputs[i + 1].type = INPUT_MOUSE;
+    inputs[i + 1].mi.dwFlags = upFlag;
+  }
+}
+
+// Sleeps on a high-resolution timer while the deadline is comfortably far
+// away, then spins so the click lands as close to the deadline as possible.
+// Returns false as soon as a stop is requested.
+bool WaitUntil(HANDLE timer, int64_t deadline, int64_t frequency, const std::atomic<bool>& stopRequested) {
+  const int64_t spinTicks = frequency / 1000;
+  const int64_t sliceTicks = frequency * kStopCheckMillis / 1000;
+  for (;;) {
+    if (stopRequested.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    int64_t remaining = deadline - TraceTimestamp();
+    if (remaining <= 0) {
+      return true;
+    }
+    if (timer && remaining > 2 * spinTicks) {
+      LARGE_INTEGER due{};
+      int64_t sleepTicks = std::min(remaining - spinTicks, sliceTicks);
+      due.QuadPart = -static_cast<LONGLONG>(sleepTicks * 10'000'000 / frequency);
+      if (SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE)) {
+        WaitForSingleObject(timer, INFINITE);
+        continue;
+      }
+    }
+    YieldProcessor();
+  }
+}
+}  // namespace
+
+void SendClick(const MacroAction& action) {
+  SetCursorPos(static_cast<int>(action.x), static_cast<int>(action.y));
+
+  DWORD downFlag = 0;
+  DWORD upFlag = 0;
+  ClickFlags(action.kind, downFlag, upFlag);
+
+  INPUT inputs[2]{};
+  inputs[0].type = INPUT_MOUSE;
+  inputs[0].mi.dwFlags = downFlag;
+  inputs[1].type = INPUT_MOUSE;
+  inputs[1].mi.dwFlags = upFlag;
+  SendInput(2, inputs, sizeof(INPUT));
+}
+
+BurstStats SendBurst(const MacroAction& action, const std::atomic<bool>& stopRequested) {
+  TRACE_ZONE("SendBurst");
+  BurstStats stats{};
+  if (action.count <= 0) {
+    return stats;
+  }
+
+  SetCursorPos(static_cast<int>(action.x), static_cast<int>(action.y));
+
+  const size_t total = static_cast<size_t>(action.count);
+  const int64_t frequency = TraceTicksPerSecond();
+  const int64_t start = TraceTimestamp();
+
+  if (action.interval <= 0.0) {
+    std::vector<INPUT> inputs(2 * std::min(total, kBurstBatchClicks));
+    FillClicks(inputs, action.button);
+    while (stats.clicks < total && !stopRequested.load(std::memory_order_relaxed)) {
+      size_t batch = std::min(total - stats.clicks, kBurstBatchClicks);
+      UINT sent = SendInput(static_cast<UINT>(2 * batch), inputs.data(), sizeof(INPUT));
+      if (sent % 2 != 0) {
+        // A partial send that stopped after a down event would leave the button held.
+        sent += SendInput(1, &inputs[1], sizeof(INPUT));
+      }
+      if (sent == 0) {
+        break;
+      }
+      stats.clicks += sent / 2;
+    }
+  } else {
+    std::vector<INPUT> inputs(2);
+    FillClicks(inputs, action.button);
+    HANDLE timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    const double intervalTicks = action.interval * static_cast<double>(frequency);
+    const double microsPerTick = 1'000'000.0 / static_cast<double>(frequency);
+    double jitterSum = 0.0;
+    for (size_t i = 0; i < total && !stopRequested.load(std::memory_order_relaxed); ++i) {
+      // Deadlines come from the start time, so a late click never pushes back the rest of the burst.
+      int64_t deadline = start + static_cast<int64_t>(std::llround(intervalTicks * static_cast<double>(i)));
+      if (!WaitUntil(timer, deadline, frequency, stopRequested)) {
+        break;
+      }
+      double jitter = static_cast<double>(TraceTimestamp() - deadline) * microsPerTick;
+      // Checked again right before sending: Stop must never be followed by one more click.
+      if (stopRequested.load(std::memory_order_relaxed)) {
+        break;
+      }
+      if (SendInput(2, inputs.data(), sizeof(INPUT)) == 1) {
+        SendInput(1, &inputs[1], sizeof(INPUT));
+      }
+      jitterSum += jitter;
+      stats.maxJitterMicros = std::max(stats.maxJitterMicros, jitter);
+      ++stats.clicks;
+    }
+    if (timer) {
+      CloseHandle(timer);
+    }
+    stats.meanJitterMicros = stats.clicks > 0 ? jitterSum / static_cast<double>(stats.clicks) : 0.0;
+  }
+
+  stats.elapsedSeconds = static_cast<double>(TraceTimestamp() - start) / static_cast<double>(frequency);
+  stats.clicksPerSecond = stats.elapsedSeconds > 0.0 ? static_cast<double>(stats.clicks) / stats.elapsedSeconds : 0.0;
+  return stats;
+}
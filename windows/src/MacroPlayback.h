@@ -0,0 +1,17 @@
+#pragma once
+
+#include "MacroAction.h"
+
+#include <atomic>
+#include <cstddef>
+
+struct BurstStats {
+  size_t clicks = 0;
+  double elapsedSeconds = 0.0;
+  double clicksPerSecond = 0.0;
+  double meanJitterMicros = 0.0;
+  double maxJitterMicros = 0.0;
+};
+
+void SendClick(const MacroAction& action);
+BurstStats SendBurst(const MacroAction& action, const std::atomic<bool>& stopRequested);
@@ -0,0 +1,527 @@
+#include "pch.h"
+#include "MacroService.h"
+#include "MacroBlocks.h"
+#include "MacroPlayback.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+constexpr DWORD kMaxMessageBytes = 64 * 1024;
+constexpr size_t kListenBacklog = 4;
+constexpr ULONG_PTR kExitKey = 1;
+}  // namespace
+
+struct MacroService::Connection {
+  enum class State {
+    Connecting,
+    Reading,
+    Writing
+  };
+
+  OVERLAPPED overlapped{};
+  HANDLE pipe = INVALID_HANDLE_VALUE;
+  State state = State::Connecting;
+  uint8_t buffer[kMaxMessageBytes]{};
+  ServiceResponse response{};
+};
+
+MacroService::~MacroService() {
+  Stop();
+}
+
+bool MacroService::Start(size_t ioThreads) {
+  if (m_running.load()) {
+    return true;
+  }
+
+  m_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, static_cast<DWORD>(ioThreads));
+  if (!m_port) {
+    return false;
+  }
+  m_running = true;
+  if (!Listen(true)) {
+    m_running = false;
+    CloseHandle(m_port);
+    m_port = nullptr;
+    return false;
+  }
+  for (size_t i = 1; i < kListenBacklog; ++i) {
+    Listen(false);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shutdown = false;
+  }
+  m_player = std::thread([this]() { PlayerLoop(); });
+  m_loader = std::thread([this]() { LoaderLoop(); });
+  for (size_t i = 0; i < std::max<size_t>(1, ioThreads); ++i) {
+    m_ioThreads.emplace_back([this]() { IoLoop(); });
+  }
+  return true;
+}
+
+void MacroService::Stop() {
+  if (!m_running.exchange(false)) {
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(m_connectionsMutex);
+    for (auto* connection : m_connections) {
+      CancelIoEx(connection->pipe, nullptr);
+    }
+    // Cancelled operations still complete through the port; wait for the I/O
+    // threads to retire every connection before its OVERLAPPED is freed.
+    m_connectionsDrained.wait_for(lock, std::chrono::seconds(2), [this]() { return m_connections.empty(); });
+  }
+  for (size_t i = 0; i < m_ioThreads.size(); ++i) {
+    PostQueuedCompletionStatus(m_port, 0, kExitKey, nullptr);
+  }
+  for (auto& thread : m_ioThreads) {
+    thread.join();
+  }
+  m_ioThreads.clear();
+  {
+    std::lock_guard<std::mutex> lock(m_connectionsMutex);
+    for (auto* connection : m_connections) {
+      CloseHandle(connection->pipe);
+      delete connection;
+    }
+    m_connections.clear();
+  }
+  CloseHandle(m_port);
+  m_port = nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shutdown = true;
+    m_stopRequested = true;
+  }
+  m_playerWake.notify_all();
+  m_loaderWake.notify_all();
+  if (m_player.joinable()) {
+    m_player.join();
+  }
+  // A parse already under way finishes first; queued loads are dropped.
+  if (m_loader.joinable()) {
+    m_loader.join();
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_loadQueue.clear();
+  for (auto& slot : m_slots) {
+    if (slot.state == SlotState::Loading) {
+      slot.state = SlotState::Failed;
+    }
+  }
+}
+
+bool MacroService::Listen(bool firstInstance) {
+  DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (firstInstance ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0);
+  HANDLE pipe = CreateNamedPipeW(kServicePipeName, openMode,
+                                 PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                 PIPE_UNLIMITED_INSTANCES, kMaxMessageBytes, kMaxMessageBytes, 0, nullptr);
+  if (pipe == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  if (!CreateIoCompletionPort(pipe, m_port, 0, 0)) {
+    CloseHandle(pipe);
+    return false;
+  }
+
+  auto* connection = new Connection();
+  connection->pipe = pipe;
+  {
+    std::lock_guard<std::mutex> lock(m_connectionsMutex);
+    m_connections.insert(connection);
+  }
+
+  if (ConnectNamedPipe(pipe, &connection->overlapped)) {
+    return true;
+  }
+  DWORD error = GetLastError();
+  if (error == ERROR_IO_PENDING) {
+    CancelIfStopping(connection);
+    return true;
+  }
+  if (error == ERROR_PIPE_CONNECTED) {
+    // The client won the race; no completion is queued for this case.
+    PostQueuedCompletionStatus(m_port, 0, 0, &connection->overlapped);
+    return true;
+  }
+  CloseConnection(connection);
+  return false;
+}
+
+void MacroService::IoLoop() {
+  winrt::init_apartment(winrt::apartment_type::multi_threaded);
+  for (;;) {
+    DWORD bytes = 0;
+    ULONG_PTR key = 0;
+    OVERLAPPED* overlapped = nullptr;
+    BOOL ok = GetQueuedCompletionStatus(m_port, &bytes, &key, &overlapped, INFINITE);
+    if (!overlapped) {
+      if (key == kExitKey || !ok) {
+        break;
+      }
+      continue;
+    }
+    auto* connection = CONTAINING_RECORD(overlapped, Connection, overlapped);
+    OnCompletion(connection, ok != FALSE, bytes);
+  }
+  winrt::uninit_apartment();
+}
+
+void MacroService::OnCompletion(Connection* connection, bool ok, DWORD bytes) {
+  if (!ok || !m_running.load()) {
+    CloseConnection(connection);
+    return;
+  }
+
+  switch (connection->state) {
+    case Connection::State::Connecting:
+      // Keep the backlog of waiting instances topped up.
+      Listen(false);
+      BeginRead(connection);
+      break;
+    case Connection::State::Reading:
+      connection->response = HandleRequest(connection->buffer, bytes);
+      BeginWrite(connection);
+      break;
+    case Connection::State::Writing:
+      BeginRead(connection);
+      break;
+  }
+}
+
+void MacroService::BeginRead(Connection* connection) {
+  connection->state = Connection::State::Reading;
+  connection->overlapped = {};
+  if (!ReadFile(connection->pipe, connection->buffer, kMaxMessageBytes, nullptr, &connection->overlapped) &&
+      GetLastError() != ERROR_IO_PENDING) {
+    CloseConnection(connection);
+    return;
+  }
+  CancelIfStopping(connection);
+}
+
+void MacroService::BeginWrite(Connection* connection) {
+  connection->state = Connection::State::Writing;
+  connection->overlapped = {};
+  if (!WriteFile(connection->pipe, &connection->response, sizeof(ServiceResponse), nullptr,
+                 &connection->overlapped) &&
+      GetLastError() != ERROR_IO_PENDING) {
+    CloseConnection(connection);
+    return;
+  }
+  CancelIfStopping(connection);
+}
+
+void MacroService::CancelIfStopping(Connection* connection) {
+  // Stop() clears m_running before cancelling what is pending, so an
+  // operation issued concurrently with Stop() is cancelled by one side or the other.
+  if (!m_running.load()) {
+    CancelIoEx(connection->pipe, &connection->overlapped);
+  }
+}
+
+void MacroService::CloseConnection(Connection* connection) {
+  DisconnectNamedPipe(connection->pipe);
+  CloseHandle(connection->pipe);
+  std::lock_guard<std::mutex> lock(m_connectionsMutex);
+  m_connections.erase(connection);
+  delete connection;
+  if (m_connections.empty()) {
+    m_connectionsDrained.notify_all();
+  }
+}
+
+ServiceResponse MacroService::HandleRequest(const uint8_t* data, DWORD size) {
+  TRACE_ZONE("ServiceRequest");
+  ServiceResponse response{};
+  response.status = ServiceStatus::BadRequest;
+  if (size < sizeof(ServiceRequest)) {
+    return response;
+  }
+  ServiceRequest request{};
+  std::memcpy(&request, data, sizeof(request));
+  if (request.length != size - sizeof(ServiceRequest)) {
+    return response;
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  switch (request.op) {
+    case ServiceOp::Load: {
+      if (request.length == 0 || request.length % sizeof(wchar_t) != 0) {
+        return response;
+      }
+      std::wstring path(request.length / sizeof(wchar_t), L'\0');
+      std::memcpy(path.data(), data + sizeof(ServiceRequest), request.length);
+
+      auto found = m_slotByPath.find(path);
+      if (found != m_slotByPath.end()) {
+        const auto& slot = m_slots[found->second];
+        response.slot = found->second;
+        response.steps = slot.steps;
+        if (slot.state == SlotState::Loading) {
+          response.status = ServiceStatus::Pending;
+          return response;
+        }
+        if (!(request.flags & kServiceFlagReload)) {
+          response.status = slot.state == SlotState::Ready ? ServiceStatus::Ok : ServiceStatus::LoadFailed;
+          return response;
+        }
+      } else {
+        if (m_slots.size() > UINT16_MAX) {
+          response.status = ServiceStatus::LoadFailed;
+          return response;
+        }
+        response.slot = static_cast<uint16_t>(m_slots.size());
+        Slot slot{};
+        slot.path = path;
+        m_slots.push_back(std::move(slot));
+        m_slotByPath.emplace(path, response.slot);
+      }
+
+      // I/O threads never touch the file system; the loader thread parses and fills the slot in.
+      m_slots[response.slot].state = SlotState::Loading;
+      m_loadQueue.push_back(response.slot);
+      m_loaderWake.notify_one();
+      response.status = ServiceStatus::Pending;
+      return response;
+    }
+    case ServiceOp::Play:
+      if (request.slot >= m_slots.size()) {
+        response.status = ServiceStatus::NotFound;
+        return response;
+      }
+      if (!m_slots[request.slot].document) {
+        response.status =
+            m_slots[request.slot].state == SlotState::Loading ? ServiceStatus::Pending : ServiceStatus::LoadFailed;
+        response.slot = request.slot;
+        return response;
+      }
+      if (m_slots[request.slot].steps == 0) {
+        response.status = ServiceStatus::EmptyMacro;
+        response.slot = request.slot;
+        return response;
+      }
+      m_pendingSlot = request.slot;
+      m_pendingLoop = (request.flags & kServiceFlagLoop) != 0;
+      m_stopRequested = true;
+      m_playerWake.notify_all();
+      response.status = ServiceStatus::Ok;
+      response.slot = request.slot;
+      return response;
+    case ServiceOp::Stop:
+      RequestStopLocked();
+      response.status = ServiceStatus::Ok;
+      return response;
+    case ServiceOp::Status:
+      response.status = ServiceStatus::Ok;
+      response.playing = m_playing.load() ? 1 : 0;
+      response.slot = m_currentSlot.load();
+      response.steps = m_stepsPlayed.load();
+      return response;
+  }
+  return response;
+}
+
+void MacroService::LoaderLoop() {
+  winrt::init_apartment(winrt::apartment_type::multi_threaded);
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+      m_loaderWake.wait(lock, [this]() { return m_shutdown || !m_loadQueue.empty(); });
+      if (m_shutdown) {
+        break;
+      }
+      uint16_t index = m_loadQueue.front();
+      m_loadQueue.pop_front();
+      std::wstring path = m_slots[index].path;
+
+      lock.unlock();
+      MacroDocument document;
+      bool loaded = ReadMacroFromFile(path, document);
+      uint32_t steps = loaded ? static_cast<uint32_t>(ExpandedStepCount(document.steps, document.blocks)) : 0;
+      lock.lock();
+
+      auto& slot = m_slots[index];
+      if (loaded) {
+        slot.document = std::make_shared<const MacroDocument>(std::move(document));
+        slot.steps = steps;
+        slot.state = SlotState::Ready;
+      } else {
+        slot.state = SlotState::Failed;
+      }
+    }
+  }
+  winrt::uninit_apartment();
+}
+
+bool MacroService::StopPlayback() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  bool wasPlaying = m_playing.load() || m_pendingSlot >= 0;
+  RequestStopLocked();
+  return wasPlaying;
+}
+
+void MacroService::RequestStopLocked() {
+  m_pendingSlot = -1;
+  m_stopRequested = true;
+  m_playerWake.notify_all();
+}
+
+void MacroService::PlayerLoop() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_playerWake.wait(lock, [this]() { return m_shutdown || m_pendingSlot >= 0; });
+    if (m_shutdown) {
+      return;
+    }
+
+    auto slot = static_cast<uint16_t>(m_pendingSlot);
+    auto macro = m_slots[slot].document;
+    bool loop = m_pendingLoop;
+    m_pendingSlot = -1;
+    m_stopRequested = false;
+    m_currentSlot = slot;
+    m_stepsPlayed = 0;
+    m_playing = true;
+
+    do {
+      // A pass that plays nothing never releases the lock, so looping it would wedge every request.
+      const uint32_t playedBefore = m_stepsPlayed.load();
+      PlaySteps(macro->steps, macro->blocks, lock, 0);
+      if (m_stepsPlayed.load() == playedBefore) {
+        break;
+      }
+    } while (loop && !m_stopRequested.load());
+
+    m_playing = false;
+  }
+}
+
+bool MacroService::PlaySteps(const std::vector<MacroAction>& steps, const BlockTable& blocks,
+                             std::unique_lock<std::mutex>& lock, int depth) {
+  for (const auto& action : steps) {
+    if (action.delay > 0 &&
+        m_playerWake.wait_for(lock, std::chrono::duration<double>(action.delay),
+                              [this]() { return m_stopRequested.load(); })) {
+      return false;
+    }
+    if (m_stopRequested.load()) {
+      return false;
+    }
+    if (action.kind == ActionKind::Call) {
+      auto block = blocks.find(action.block);
+      if (block != blocks.end() && depth < kMaxCallDepth) {
+        for (int i = 0; i < action.repeat; ++i) {
+          if (!PlaySteps(*block->second, blocks, lock, depth + 1)) {
+            return false;
+          }
+        }
+      }
+      continue;
+    }
+    lock.unlock();
+    if (action.kind == ActionKind::Burst) {
+      SendBurst(action, m_stopRequested);
+    } else if (action.kind != ActionKind::Wait) {
+      SendClick(action);
+    }
+    lock.lock();
+    ++m_stepsPlayed;
+  }
+  return true;
+}
+
+MacroServiceClient::~MacroServiceClient() {
+  if (m_pipe != INVALID_HANDLE_VALUE) {
+    CloseHandle(m_pipe);
+  }
+}
+
+bool MacroServiceClient::Connect(DWORD timeoutMs) {
+  if (!WaitNamedPipeW(kServicePipeName, timeoutMs)) {
+    return false;
+  }
+  m_pipe = CreateFileW(kServicePipeName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+  if (m_pipe == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  DWORD mode = PIPE_READMODE_MESSAGE;
+  return SetNamedPipeHandleState(m_pipe, &mode, nullptr, nullptr) != FALSE;
+}
+
+bool MacroServiceClient::Call(ServiceOp op, uint16_t slot, uint8_t flags, const std::wstring& payload,
+                              ServiceResponse& response) {
+  if (m_pipe == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  ServiceRequest request{op, flags, slot, static_cast<uint32_t>(payload.size() * sizeof(wchar_t))};
+  m_buffer.resize(sizeof(request) + request.length);
+  std::memcpy(m_buffer.data(), &request, sizeof(request));
+  if (request.length > 0) {
+    std::memcpy(m_buffer.data() + sizeof(request), payload.data(), request.length);
+  }
+
+  DWORD read = 0;
+  if (!TransactNamedPipe(m_pipe, m_buffer.data(), static_cast<DWORD>(m_buffer.size()), &response, sizeof(response),
+                         &read, nullptr)) {
+    return false;
+  }
+  return read == sizeof(response);
+}
+
+ServiceBenchmark RunServiceBenchmark(size_t clients, size_t callsPerClient) {
+  clients = std::max<size_t>(1, clients);
+  std::vector<std::vector<double>> latencies(clients);
+  std::vector<size_t> failures(clients, 0);
+  std::vector<std::thread> threads;
+
+  const double microsPerTick = 1'000'000.0 / static_cast<double>(TraceTicksPerSecond());
+
+  int64_t start = TraceTimestamp();
+  for (size_t c = 0; c < clients; ++c) {
+    threads.emplace_back([&, c]() {
+      MacroServiceClient client;
+      if (!client.Connect()) {
+        failures[c] = callsPerClient;
+        return;
+      }
+      latencies[c].reserve(callsPerClient);
+      for (size_t i = 0; i < callsPerClient; ++i) {
+        ServiceResponse response{};
+        int64_t before = TraceTimestamp();
+        if (!client.Call(ServiceOp::Status, 0, 0, {}, response)) {
+          ++failures[c];
+          continue;
+        }
+        latencies[c].push_back(static_cast<double>(TraceTimestamp() - before) * microsPerTick);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double elapsedSeconds = static_cast<double>(TraceTimestamp() - start) * microsPerTick / 1'000'000.0;
+
+  ServiceBenchmark result{};
+  std::vector<double> all;
+  for (size_t c = 0; c < clients; ++c) {
+    all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+    result.failures += failures[c];
+  }
+  result.calls = all.size();
+  if (!all.empty()) {
+    std::sort(all.begin(), all.end());
+    result.p50Micros = all[all.size() / 2];
+    result.p99Micros = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+    result.callsPerSecond = elapsedSeconds > 0.0 ? static_cast<double>(all.size()) / elapsedSeconds : 0.0;
+  }
+  return result;
+}
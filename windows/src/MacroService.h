@@ -0,0 +1,156 @@
+#pragma once
+
+#include "MacroAction.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+constexpr wchar_t kServicePipeName[] = L"\\\\.\\pipe\\EasyMacro";
+
+// Wire format: one request message in, one response message out. All
+// fields are little-endian; a Load payload is the UTF-16 path of the macro.
+// Load answers Pending with the slot straight away and parses in the
+// background; repeating the Load without kServiceFlagReload reports Ok or
+// LoadFailed once the parse has finished.
+enum class ServiceOp : uint8_t {
+  Load = 1,
+  Play = 2,
+  Stop = 3,
+  Status = 4
+};
+
+enum class ServiceStatus : uint8_t {
+  Ok = 0,
+  BadRequest = 1,
+  NotFound = 2,
+  LoadFailed = 3,
+  EmptyMacro = 4,
+  Pending = 5
+};
+
+constexpr uint8_t kServiceFlagLoop = 0x01;
+constexpr uint8_t kServiceFlagReload = 0x02;
+
+#pragma pack(push, 1)
+struct ServiceRequest {
+  ServiceOp op;
+  uint8_t flags;
+  uint16_t slot;
+  uint32_t length;
+};
+
+struct ServiceResponse {
+  ServiceStatus status;
+  uint8_t playing;
+  uint16_t slot;
+  uint32_t steps;
+};
+#pragma pack(pop)
+
+// Background macro service on a local named pipe. Every pipe instance is
+// served by overlapped I/O on one completion port, so a small fixed set of
+// threads handles any number of clients. Loaded macros stay resident and a
+// dedicated player thread runs them.
+class MacroService {
+ public:
+  MacroService() = default;
+  ~MacroService();
+
+  MacroService(const MacroService&) = delete;
+  MacroService& operator=(const MacroService&) = delete;
+
+  bool Start(size_t ioThreads = 2);
+  void Stop();
+  bool IsRunning() const { return m_running.load(); }
+  // Same as a client's Stop request; returns whether a macro was playing.
+  bool StopPlayback();
+
+ private:
+  struct Connection;
+  enum class SlotState {
+    Loading,
+    Ready,
+    Failed
+  };
+  struct Slot {
+    std::wstring path{};
+    SlotState state = SlotState::Loading;
+    // Stays playable while a reload is in flight or after it fails.
+    std::shared_ptr<const MacroDocument> document{};
+    // Steps a full pass executes once Calls are expanded.
+    uint32_t steps = 0;
+  };
+
+  bool Listen(bool firstInstance);
+  void IoLoop();
+  void OnCompletion(Connection* connection, bool ok, DWORD bytes);
+  void BeginRead(Connection* connection);
+  void BeginWrite(Connection* connection);
+  void CancelIfStopping(Connection* connection);
+  void CloseConnection(Connection* connection);
+  ServiceResponse HandleRequest(const uint8_t* data, DWORD size);
+  void RequestStopLocked();
+  void PlayerLoop();
+  void LoaderLoop();
+  // Returns false once a stop is requested; Call steps recurse into the shared blocks.
+  bool PlaySteps(const std::vector<MacroAction>& steps, const BlockTable& blocks, std::unique_lock<std::mutex>& lock,
+                 int depth);
+
+  HANDLE m_port = nullptr;
+  std::atomic<bool> m_running{false};
+  std::vector<std::thread> m_ioThreads{};
+  std::mutex m_connectionsMutex{};
+  std::condition_variable m_connectionsDrained{};
+  std::unordered_set<Connection*> m_connections{};
+
+  std::mutex m_mutex{};
+  std::condition_variable m_playerWake{};
+  std::condition_variable m_loaderWake{};
+  std::deque<uint16_t> m_loadQueue{};
+  std::vector<Slot> m_slots{};
+  std::unordered_map<std::wstring, uint16_t> m_slotByPath{};
+  int m_pendingSlot = -1;
+  bool m_pendingLoop = false;
+  bool m_shutdown = false;
+  std::atomic<bool> m_stopRequested{false};
+  std::atomic<bool> m_playing{false};
+  std::atomic<uint16_t> m_currentSlot{0};
+  std::atomic<uint32_t> m_stepsPlayed{0};
+  std::thread m_player{};
+  std::thread m_loader{};
+};
+
+class MacroServiceClient {
+ public:
+  MacroServiceClient() = default;
+  ~MacroServiceClient();
+
+  MacroServiceClient(const MacroServiceClient&) = delete;
+  MacroServiceClient& operator=(const MacroServiceClient&) = delete;
+
+  bool Connect(DWORD timeoutMs = 1000);
+  bool Call(ServiceOp op, uint16_t slot, uint8_t flags, const std::wstring& payload, ServiceResponse& response);
+
+ private:
+  HANDLE m_pipe = INVALID_HANDLE_VALUE;
+  std::vector<uint8_t> m_buffer{};
+};
+
+struct ServiceBenchmark {
+  size_t calls = 0;
+  size_t failures = 0;
+  double p50Micros = 0.0;
+  double p99Micros = 0.0;
+  double callsPerSecond = 0.0;
+};
+
+ServiceBenchmark RunServiceBenchmark(size_t clients, size_t callsPerClient);
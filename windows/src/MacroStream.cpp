@@ -0,0 +1,419 @@
+#include "pch.h"
+#include "MacroStream.h"
+#include "Trace.h"
+
+#include <psapi.h>
+#include <algorithm>
+#include <filesystem>
+
+using winrt::Windows::Data::Json::JsonObject;
+
+namespace {
+ProcessMemory CurrentProcessMemory() {
+  PROCESS_MEMORY_COUNTERS_EX counters{};
+  counters.cb = sizeof(counters);
+  ProcessMemory memory{};
+  if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters),
+                           sizeof(counters))) {
+    memory.workingSetBytes = counters.WorkingSetSize;
+    memory.privateBytes = counters.PrivateUsage;
+  }
+  return memory;
+}
+
+size_t StringHeapBytes(const std::string& text) {
+  // Strings within the small-string buffer own no heap memory.
+  return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+}
+
+size_t ActionsHeapBytes(const std::vector<MacroAction>& actions) {
+  size_t bytes = actions.capacity() * sizeof(MacroAction);
+  for (const auto& action : actions) {
+    bytes += StringHeapBytes(action.id) + StringHeapBytes(action.block);
+  }
+  return bytes;
+}
+}  // namespace
+
+MacroStreamReader::MacroStreamReader(std::wstring path, size_t batchSize, size_t chunkBytes)
+    : m_path(std::move(path)), m_batchSize(std::max<size_t>(1, batchSize)), m_chunk(chunkBytes) {
+  m_batches[0].reserve(m_batchSize);
+  m_batches[1].reserve(m_batchSize);
+}
+
+MacroStreamReader::~MacroStreamReader() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shutdown = true;
+  }
+  m_cv.notify_all();
+  if (m_producer.joinable()) {
+    m_producer.join();
+  }
+}
+
+bool MacroStreamReader::Open() {
+  m_file.open(std::filesystem::path(m_path), std::ios::binary);
+  if (!m_file || !ResetSource()) {
+    m_failed = true;
+    return false;
+  }
+
+  m_producer = std::thread([this]() { ProducerLoop(); });
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_fillRequested = true;
+  m_cv.notify_all();
+  m_cv.wait(lock, [this]() { return m_backReady; });
+  return !m_failed;
+}
+
+const MacroAction* MacroStreamReader::Next() {
+  for (;;) {
+    auto& front = m_batches[m_front];
+    if (m_frontPos < front.size()) {
+      ++m_stepsRead;
+      return &front[m_frontPos++];
+    }
+    if (m_frontEnded) {
+      return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_backReady) {
+      ++m_starved;
+      TRACE_ZONE("StreamStarved");
+      m_cv.wait(lock, [this]() { return m_backReady; });
+    }
+    m_front = 1 - m_front;
+    m_frontPos = 0;
+    m_frontEnded = m_backEnded;
+    m_backReady = false;
+    if (!m_frontEnded) {
+      m_fillRequested = true;
+      m_cv.notify_all();
+    }
+  }
+}
+
+void MacroStreamReader::Rewind() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this]() { return !m_producerBusy && !m_fillRequested; });
+  m_batches[m_front].clear();
+  m_frontPos = 0;
+  m_frontEnded = false;
+  m_backReady = false;
+  m_rewindRequested = true;
+  m_fillRequested = true;
+  m_cv.notify_all();
+}
+
+void MacroStreamReader::ProducerLoop() {
+  winrt::init_apartment(winrt::apartment_type::multi_threaded);
+  for (;;) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this]() { return m_shutdown || m_fillRequested; });
+    if (m_shutdown) {
+      break;
+    }
+    m_fillRequested = false;
+    m_producerBusy = true;
+    bool rewind = m_rewindRequested;
+    m_rewindRequested = false;
+    size_t backIndex = 1 - m_front;
+    auto& back = m_batches[backIndex];
+    lock.unlock();
+
+    bool ok = !rewind || ResetSource();
+    {
+      TRACE_ZONE("StreamPrefetch");
+      // Refill in place so the batch keeps its capacity. Each parsed action is
+      // move-assigned over its slot, so string buffers are replaced, not reused.
+      size_t count = 0;
+      while (ok && count < m_batchSize && !m_sourceDone) {
+        if (count == back.size()) {
+          back.emplace_back();
+        }
+        if (!ReadNextAction(back[count])) {
+          break;
+        }
+        ++count;
+      }
+      back.resize(count);
+    }
+    size_t backBytes = ActionsHeapBytes(back);
+    size_t fixedBytes = m_chunk.capacity() + StringHeapBytes(m_objectText) + m_blockBytes;
+
+    lock.lock();
+    m_batchBytes[backIndex] = backBytes;
+    size_t total = m_batchBytes[0] + m_batchBytes[1] + fixedBytes;
+    if (total > m_peakBytes.load()) {
+      m_peakBytes = total;
+    }
+    if (!ok) {
+      m_failed = true;
+    }
+    m_backEnded = m_sourceDone || m_failed;
+    m_backReady = true;
+    m_producerBusy = false;
+    m_cv.notify_all();
+  }
+  winrt::uninit_apartment();
+}
+
+bool MacroStreamReader::ResetSource() {
+  if (m_stepsOffset != 0) {
+    SeekSource(m_stepsOffset);
+    return true;
+  }
+  SeekSource(0);
+
+  char value = 0;
+  if (!ReadByte(value)) {
+    return false;
+  }
+  if (static_cast<unsigned char>(value) == 0xEF) {
+    char bom[2]{};
+    if (!ReadByte(bom[0]) || !ReadByte(bom[1]) || !ReadByte(value)) {
+      return false;
+    }
+  }
+  while (value == ' ' || value == '\t' || value == '\r' || value == '\n') {
+    if (!ReadByte(value)) {
+      return false;
+    }
+  }
+  if (value == '[') {
+    m_stepsOffset = m_chunkOffset + m_chunkPos;
+    return true;
+  }
+  return value == '{' && FindSteps();
+}
+
+bool MacroStreamReader::FindSteps() {
+  // Walks the top-level keys of {"blocks": {...}, "steps": [...]} in either
+  // order: blocks are parsed whole, steps only have their start recorded.
+  bool haveBlocks = false;
+  uint64_t stepsOffset = 0;
+  char value = 0;
+  while (ReadNonSpace(value) && value != '}') {
+    if (value == ',') {
+      continue;
+    }
+    if (value != '"') {
+      return false;
+    }
+    std::string key;
+    if (!ReadValue(value, &key) || !ReadNonSpace(value) || value != ':' || !ReadNonSpace(value)) {
+      return false;
+    }
+    if (key == "\"steps\"") {
+      if (value != '[') {
+        return false;
+      }
+      stepsOffset = m_chunkOffset + m_chunkPos;
+      if (haveBlocks) {
+        break;
+      }
+      if (!ReadValue(value, nullptr)) {
+        return false;
+      }
+    } else if (key == "\"blocks\"") {
+      m_objectText.clear();
+      if (value != '{' || !ReadValue(value, &m_objectText)) {
+        return false;
+      }
+      try {
+        m_blocks = ParseBlocksFromJson(JsonObject::Parse(winrt::to_hstring(m_objectText)));
+        m_blockBytes = 0;
+        for (const auto& [id, block] : m_blocks) {
+          m_blockBytes += StringHeapBytes(id) + ActionsHeapBytes(*block);
+        }
+      } catch (...) {
+        return false;
+      }
+      if (!CallGraphIsBounded(m_blocks)) {
+        return false;
+      }
+      haveBlocks = true;
+      if (stepsOffset != 0) {
+        break;
+      }
+    } else if (!ReadValue(value, nullptr)) {
+      return false;
+    }
+  }
+  if (stepsOffset == 0) {
+    return false;
+  }
+  m_stepsOffset = stepsOffset;
+  SeekSource(m_stepsOffset);
+  return true;
+}
+
+bool MacroStreamReader::ReadValue(char first, std::string* text) {
+  // Consumes one JSON value whose first byte was already read. Strings and
+  // containers end on their closing byte; scalars end on a delimiter, which
+  // is pushed back for the caller.
+  auto keep = [text](char value) {
+    if (text) {
+      text->push_back(value);
+    }
+  };
+  keep(first);
+  if (first != '{' && first != '[' && first != '"') {
+    char value = 0;
+    while (ReadByte(value)) {
+      if (value == ',' || value == '}' || value == ']') {
+        --m_chunkPos;
+        return true;
+      }
+      keep(value);
+    }
+    return false;
+  }
+
+  int depth = first == '"' ? 0 : 1;
+  bool inString = first == '"';
+  bool escaped = false;
+  char value = 0;
+  while (ReadByte(value)) {
+    keep(value);
+    if (inString) {
+      if (escaped) {
+        escaped = false;
+      } else if (value == '\\') {
+        escaped = true;
+      } else if (value == '"') {
+        inString = false;
+        if (depth == 0) {
+          return true;
+        }
+      }
+    } else if (value == '"') {
+      inString = true;
+    } else if (value == '{' || value == '[') {
+      ++depth;
+    } else if ((value == '}' || value == ']') && --depth == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void MacroStreamReader::SeekSource(uint64_t offset) {
+  m_file.clear();
+  m_file.seekg(static_cast<std::streamoff>(offset));
+  m_chunkOffset = offset;
+  m_chunkPos = 0;
+  m_chunkLength = 0;
+  m_sourceDone = false;
+}
+
+bool MacroStreamReader::ReadByte(char& value) {
+  if (m_chunkPos == m_chunkLength) {
+    m_chunkOffset += m_chunkLength;
+    m_file.read(m_chunk.data(), static_cast<std::streamsize>(m_chunk.size()));
+    m_chunkLength = static_cast<size_t>(m_file.gcount());
+    m_chunkPos = 0;
+    if (m_chunkLength == 0) {
+      return false;
+    }
+  }
+  value = m_chunk[m_chunkPos++];
+  return true;
+}
+
+bool MacroStreamReader::ReadNonSpace(char& value) {
+  do {
+    if (!ReadByte(value)) {
+      return false;
+    }
+  } while (value == ' ' || value == '\t' || value == '\r' || value == '\n');
+  return true;
+}
+
+bool MacroStreamReader::ReadNextAction(MacroAction& action) {
+  m_objectText.clear();
+  int depth = 0;
+  bool inString = false;
+  bool escaped = false;
+  char value = 0;
+  while (ReadByte(value)) {
+    if (depth == 0) {
+      if (value == ']') {
+        m_sourceDone = true;
+        return false;
+      }
+      if (value != '{') {
+        continue;
+      }
+    }
+
+    m_objectText.push_back(value);
+    if (inString) {
+      if (escaped) {
+        escaped = false;
+      } else if (value == '\\') {
+        escaped = true;
+      } else if (value == '"') {
+        inString = false;
+      }
+      continue;
+    }
+    if (value == '"') {
+      inString = true;
+    } else if (value == '{') {
+      ++depth;
+    } else if (value == '}' && --depth == 0) {
+      try {
+        action = ActionFromJsonObject(JsonObject::Parse(winrt::to_hstring(m_objectText)));
+        return true;
+      } catch (...) {
+        m_failed = true;
+        m_sourceDone = true;
+        return false;
+      }
+    }
+  }
+
+  // Truncated file: treat whatever was read as the end of the stream.
+  m_sourceDone = true;
+  return false;
+}
+
+ProcessMemorySampler::ProcessMemorySampler(std::chrono::milliseconds period)
+    : m_period(period), m_baseline(CurrentProcessMemory()), m_peak(m_baseline) {
+  m_sampler = std::thread([this]() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_cv.wait_for(lock, m_period, [this]() { return m_shutdown; })) {
+      lock.unlock();
+      Sample();
+      lock.lock();
+    }
+  });
+}
+
+ProcessMemorySampler::~ProcessMemorySampler() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shutdown = true;
+  }
+  m_cv.notify_all();
+  if (m_sampler.joinable()) {
+    m_sampler.join();
+  }
+}
+
+ProcessMemory ProcessMemorySampler::Peak() {
+  // One last sample so a short run still reports the state at the end.
+  Sample();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_peak;
+}
+
+void ProcessMemorySampler::Sample() {
+  ProcessMemory memory = CurrentProcessMemory();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_peak.workingSetBytes = std::max(m_peak.workingSetBytes, memory.workingSetBytes);
+  m_peak.privateBytes = std::max(m_peak.privateBytes, memory.privateBytes);
+}
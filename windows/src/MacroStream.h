@@ -0,0 +1,117 @@
+#pragma once
+
+#include "MacroAction.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads actions from an .emacro file without loading the whole array. A
+// background thread parses the next batch while playback drains the current
+// one, so memory stays near two batches plus one read chunk for any file size.
+// Files saved with shared blocks load the (small) block table up front and
+// stream only the top-level steps.
+class MacroStreamReader {
+ public:
+  explicit MacroStreamReader(std::wstring path, size_t batchSize = 4096, size_t chunkBytes = 64 * 1024);
+  ~MacroStreamReader();
+
+  MacroStreamReader(const MacroStreamReader&) = delete;
+  MacroStreamReader& operator=(const MacroStreamReader&) = delete;
+
+  bool Open();
+  // Returns nullptr at the end of the stream. The pointer stays valid until the next call.
+  const MacroAction* Next();
+  void Rewind();
+
+  // Valid once Open succeeds; empty for files in the plain array format.
+  const BlockTable& Blocks() const { return m_blocks; }
+  bool Failed() const { return m_failed.load(); }
+  size_t StepsRead() const { return m_stepsRead; }
+  size_t StarvedCount() const { return m_starved; }
+  // Largest heap footprint measured after a refill: both batches with their
+  // strings, the read chunk, the scratch object text and the block table.
+  // Allocator and hash-node overhead are not counted.
+  size_t PeakMemoryBytes() const { return m_peakBytes.load(); }
+
+ private:
+  void ProducerLoop();
+  bool ResetSource();
+  bool FindSteps();
+  bool ReadValue(char first, std::string* text);
+  void SeekSource(uint64_t offset);
+  bool ReadByte(char& value);
+  bool ReadNonSpace(char& value);
+  bool ReadNextAction(MacroAction& action);
+
+  std::wstring m_path{};
+  size_t m_batchSize = 0;
+  std::ifstream m_file{};
+  std::vector<char> m_chunk{};
+  size_t m_chunkPos = 0;
+  size_t m_chunkLength = 0;
+  uint64_t m_chunkOffset = 0;
+  // File offset just past the steps array's '['; 0 until the first reset finds it.
+  uint64_t m_stepsOffset = 0;
+  BlockTable m_blocks{};
+  size_t m_blockBytes = 0;
+  std::string m_objectText{};
+  bool m_sourceDone = false;
+
+  std::vector<MacroAction> m_batches[2]{};
+  size_t m_batchBytes[2]{};
+  size_t m_front = 0;
+  size_t m_frontPos = 0;
+  bool m_frontEnded = false;
+
+  std::mutex m_mutex{};
+  std::condition_variable m_cv{};
+  bool m_fillRequested = false;
+  bool m_rewindRequested = false;
+  bool m_producerBusy = false;
+  bool m_backReady = false;
+  bool m_backEnded = false;
+  bool m_shutdown = false;
+  std::atomic<bool> m_failed{false};
+  size_t m_stepsRead = 0;
+  size_t m_starved = 0;
+  std::atomic<size_t> m_peakBytes{0};
+  std::thread m_producer{};
+};
+
+struct ProcessMemory {
+  size_t workingSetBytes = 0;
+  size_t privateBytes = 0;
+};
+
+// Samples this process's working set and private bytes on a background
+// thread from construction until destruction. Comparing the peak with the
+// first sample shows whether streaming playback grows the process at all,
+// which the reader's own buffer accounting cannot.
+class ProcessMemorySampler {
+ public:
+  explicit ProcessMemorySampler(std::chrono::milliseconds period = std::chrono::milliseconds(50));
+  ~ProcessMemorySampler();
+
+  ProcessMemorySampler(const ProcessMemorySampler&) = delete;
+  ProcessMemorySampler& operator=(const ProcessMemorySampler&) = delete;
+
+  ProcessMemory Baseline() const { return m_baseline; }
+  ProcessMemory Peak();
+
+ private:
+  void Sample();
+
+  std::chrono::milliseconds m_period;
+  ProcessMemory m_baseline{};
+  std::mutex m_mutex{};
+  std::condition_variable m_cv{};
+  ProcessMemory m_peak{};
+  bool m_shutdown = false;
+  std::thread m_sampler{};
+};
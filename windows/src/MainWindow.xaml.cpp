@@ -1,7 +1,12 @@
 #include "pch.h"
 #include "MainWindow.xaml.h"
 #include "MacroAction.h"
+#include "MacroBlocks.h"
+#include "MacroPlayback.h"
+#include "MacroStream.h"
+#include "Trace.h"
 
+#include <winrt/Microsoft.UI.Dispatching.h>
 #include <winrt/Microsoft.UI.Interop.h>
 #include <winrt/Microsoft.UI.Xaml.Controls.h>
 #include <winrt/Microsoft.UI.Xaml.Media.h>
@@ -9,11 +14,14 @@
 #include <winrt/Windows.Storage.h>
 #include <winrt/Windows.Storage.Pickers.h>
 
+#include <algorithm>
 #include <filesystem>
 #include <iomanip>
+#include <iterator>
 #include <sstream>
 #include <chrono>
 
+#include <shellapi.h>
 #include <shobjidl.h>
 
 using namespace winrt;
@@ -58,10 +66,47 @@ bool TryParseDouble(std::wstring const& text, double& value, bool allowZero = tr
   }
 }
 
-Color RowBackgroundColor(bool isSelected, int index) {
+bool TryParseSigned(std::wstring const& text, double& value) {
+  try {
+    size_t idx = 0;
+    value = std::stod(text, &idx);
+    return idx == text.size();
+  } catch (...) {
+    return false;
+  }
+}
+
+bool TryParseBurst(std::wstring const& countText, std::wstring const& intervalText, int& count, double& interval) {
+  double countValue = 0.0;
+  double intervalMs = 0.0;
+  if (!TryParseDouble(countText, countValue, false) || !TryParseDouble(intervalText, intervalMs)) {
+    return false;
+  }
+  if (countValue > kMaxBurstCount) {
+    return false;
+  }
+  count = ClampCount(countValue, 0, kMaxBurstCount);
+  interval = intervalMs / 1000.0;
+  return count > 0;
+}
+
+ActionKind ButtonFromTag(std::wstring const& tag) {
+  if (tag == L"rightClick") {
+    return ActionKind::RightClick;
+  }
+  if (tag == L"otherClick") {
+    return ActionKind::OtherClick;
+  }
+  return ActionKind::LeftClick;
+}
+
+Color RowBackgroundColor(bool isSelected, bool inRegion, int index) {
   if (isSelected) {
     return ColorHelper::FromArgb(255, 229, 229, 229);
   }
+  if (inRegion) {
+    return ColorHelper::FromArgb(255, 224, 236, 250);
+  }
   return (index % 2 == 0) ? ColorHelper::FromArgb(255, 245, 245, 245)
                           : ColorHelper::FromArgb(255, 250, 250, 250);
 }
@@ -77,10 +122,18 @@ MainWindow::MainWindow() {
   }
 
   InitializeDefaults();
+  ApplyCommandLine();
   RenderSteps();
   UpdateEditPanel();
   UpdateFileName();
 
+  // Start on the last macro straight away; a warm snapshot is usually ready before the window is shown.
+  m_recent = LoadRecentMacros();
+  RebuildRecentMenu();
+  if (!m_recent.empty()) {
+    OpenMacroPath(m_recent.front(), true);
+  }
+
   if (m_hwnd) {
     m_hotkey.Register(m_hwnd, 1, MOD_CONTROL | MOD_ALT | MOD_SHIFT, 'P', [this]() { OnPanicHotkey(); });
   }
@@ -99,15 +152,95 @@ void MainWindow::InitializeDefaults() {
   EditDelayBox().Text(L"0");
 }
 
+void MainWindow::ApplyCommandLine() {
+  int argc = 0;
+  LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+  if (!argv) {
+    return;
+  }
+  for (int i = 1; i < argc; ++i) {
+    std::wstring_view arg = argv[i];
+    if (arg == L"--trace") {
+      SetTraceEnabled(true);
+    } else if (arg == L"--service") {
+      SetServiceRunning(true);
+    } else if (arg == L"--trace-out" && i + 1 < argc) {
+      SetTraceEnabled(true);
+      m_traceOutputPath = argv[++i];
+    }
+  }
+  LocalFree(argv);
+
+  TraceToggleItem().IsChecked(TraceEnabled());
+  if (!m_traceOutputPath.empty()) {
+    Closed([this](auto&&, auto&&) { ExportTraceJson(m_traceOutputPath); });
+  }
+}
+
 void MainWindow::UpdateStatus(std::wstring_view status) {
   StatusText().Text(status);
 }
 
+void MainWindow::UpdateDurationText() {
+  if (m_actions.empty()) {
+    DurationText().Text(L"");
+    return;
+  }
+  DurationText().Text(std::to_wstring(m_durations.Count()) + L" steps, " + FormatClock(m_durations.Total()) +
+                      L" total");
+}
+
+void MainWindow::StartProgressTimer(bool streaming) {
+  m_isStreaming = streaming;
+  m_playbackStep.store(0, std::memory_order_relaxed);
+  m_playbackLoop.store(0, std::memory_order_relaxed);
+  m_stepStartedAt.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+  if (!m_progressTimer) {
+    m_progressTimer = DispatcherQueue().CreateTimer();
+    m_progressTimer.Interval(std::chrono::milliseconds(250));
+    m_progressTimer.Tick([weak = get_weak()](auto&&, auto&&) {
+      if (auto self = weak.get()) {
+        self->UpdatePlaybackProgress();
+      }
+    });
+  }
+  m_progressTimer.Start();
+}
+
+void MainWindow::UpdatePlaybackProgress() {
+  if (!m_isPlaying) {
+    return;
+  }
+  size_t step = m_playbackStep.load(std::memory_order_relaxed);
+  uint32_t loop = m_playbackLoop.load(std::memory_order_relaxed);
+
+  std::wstringstream status;
+  if (loop > 0) {
+    status << L"Loop " << loop + 1 << L", ";
+  }
+  if (m_isStreaming || m_durations.Count() == 0) {
+    status << L"step " << step + 1;
+    UpdateStatus(status.str());
+    return;
+  }
+
+  size_t count = m_durations.Count();
+  step = std::min(step, count - 1);
+  auto startedAt = std::chrono::steady_clock::time_point(
+      std::chrono::steady_clock::duration(m_stepStartedAt.load(std::memory_order_relaxed)));
+  double inStep = std::chrono::duration<double>(std::chrono::steady_clock::now() - startedAt).count();
+  inStep = std::min(inStep, m_durations.Duration(step));
+  double remaining = m_durations.Total() - m_durations.StartOffset(step) - inStep;
+  status << L"step " << step + 1 << L"/" << count << L", " << FormatClock(remaining) << L" remaining";
+  UpdateStatus(status.str());
+}
+
 void MainWindow::UpdateFileName() {
   FileNameText().Text(m_fileName);
 }
 
 void MainWindow::RenderSteps() {
+  TRACE_ZONE("RenderSteps");
   StepsPanel().Children().Clear();
 
   if (m_actions.empty()) {
@@ -115,21 +248,25 @@ void MainWindow::RenderSteps() {
       Border spacer;
       spacer.Height(28);
       spacer.CornerRadius(CornerRadiusHelper::FromUniformRadius(6));
-      spacer.Background(SolidColorBrush(RowBackgroundColor(false, i)));
+      spacer.Background(SolidColorBrush(RowBackgroundColor(false, false, i)));
       StepsPanel().Children().Append(spacer);
     }
     PlayButton().IsEnabled(false);
+    UpdateDurationText();
     return;
   }
 
   PlayButton().IsEnabled(true);
+  UpdateDurationText();
   for (size_t i = 0; i < m_actions.size(); ++i) {
     const auto& action = m_actions[i];
 
     Grid row;
     row.Padding(ThicknessHelper::FromLengths(8, 6, 8, 6));
     row.CornerRadius(CornerRadiusHelper::FromUniformRadius(6));
-    row.Background(SolidColorBrush(RowBackgroundColor(static_cast<int>(i) == m_selectedIndex, static_cast<int>(i))));
+    bool inRegion = i < m_regionMask.size() && m_regionMask[i];
+    row.Background(
+        SolidColorBrush(RowBackgroundColor(static_cast<int>(i) == m_selectedIndex, inRegion, static_cast<int>(i))));
     row.Tag(box_value(static_cast<int>(i)));
 
     ColumnDefinition colIndex;
@@ -162,6 +299,13 @@ void MainWindow::RenderSteps() {
     Grid::SetColumn(locationText, 2);
     row.Children().Append(locationText);
 
+    if (action.kind == ActionKind::Burst || action.kind == ActionKind::Call) {
+      TextBlock detailText;
+      detailText.Text(action.kind == ActionKind::Burst ? BurstLabel(action) : CallLabel(action, m_blocks));
+      Grid::SetColumn(detailText, 3);
+      row.Children().Append(detailText);
+    }
+
     TextBlock delayText;
     delayText.Text(FormatDelay(action.delay));
     delayText.HorizontalAlignment(HorizontalAlignment::Right);
@@ -206,12 +350,30 @@ void MainWindow::UpdateEditPanel() {
     case ActionKind::Wait:
       EditKindCombo().SelectedIndex(3);
       break;
+    case ActionKind::Burst:
+      EditKindCombo().SelectedIndex(4);
+      break;
+    case ActionKind::Call:
+      // Blocks are shared between call sites, so only the delay is editable
+      // here; Inline Call turns the row back into ordinary steps.
+      EditKindCombo().SelectedIndex(-1);
+      break;
   }
+  EditKindCombo().IsEnabled(action.kind != ActionKind::Call);
+  InlineCallButton().Visibility(action.kind == ActionKind::Call ? Visibility::Visible : Visibility::Collapsed);
 
   EditXBox().Text(std::to_wstring(static_cast<int>(action.x)));
   EditYBox().Text(std::to_wstring(static_cast<int>(action.y)));
   EditDelayBox().Text(std::to_wstring(action.delay));
-  EditXYRow().Visibility(action.kind == ActionKind::Wait ? Visibility::Collapsed : Visibility::Visible);
+  EditXYRow().Visibility(HasPosition(action) ? Visibility::Visible : Visibility::Collapsed);
+  EditBurstRow().Visibility(action.kind == ActionKind::Burst ? Visibility::Visible : Visibility::Collapsed);
+  if (action.kind == ActionKind::Burst) {
+    EditBurstButtonCombo().SelectedIndex(action.button == ActionKind::RightClick   ? 1
+                                         : action.button == ActionKind::OtherClick ? 2
+                                                                                   : 0);
+    EditBurstCountBox().Text(std::to_wstring(action.count));
+    EditBurstIntervalBox().Text(std::to_wstring(action.interval * 1000.0));
+  }
 }
 
 void MainWindow::AddStepButton_Click(IInspectable const&, RoutedEventArgs const&) {
@@ -222,8 +384,12 @@ void MainWindow::AddStepButton_Click(IInspectable const&, RoutedEventArgs const&
   AddYBox().Text(L"0");
   AddDelayBox().Text(L"10");
 
+  AddBurstCountBox().Text(L"1000");
+  AddBurstIntervalBox().Text(L"1");
+
   AddClickFields().Visibility(Visibility::Visible);
   AddWaitFields().Visibility(Visibility::Collapsed);
+  AddBurstFields().Visibility(Visibility::Collapsed);
   AddCustomPosition().Visibility(Visibility::Collapsed);
 
   AddStepDialog().XamlRoot(Content().XamlRoot());
@@ -231,9 +397,11 @@ void MainWindow::AddStepButton_Click(IInspectable const&, RoutedEventArgs const&
 }
 
 void MainWindow::AddTypeRadio_Checked(IInspectable const&, RoutedEventArgs const&) {
-  bool isClick = IsRadioChecked(AddTypeClickRadio());
-  AddClickFields().Visibility(isClick ? Visibility::Visible : Visibility::Collapsed);
-  AddWaitFields().Visibility(isClick ? Visibility::Collapsed : Visibility::Visible);
+  bool isWait = IsRadioChecked(AddTypeWaitRadio());
+  bool isBurst = IsRadioChecked(AddTypeBurstRadio());
+  AddClickFields().Visibility(isWait ? Visibility::Collapsed : Visibility::Visible);
+  AddWaitFields().Visibility(isWait ? Visibility::Visible : Visibility::Collapsed);
+  AddBurstFields().Visibility(isBurst ? Visibility::Visible : Visibility::Collapsed);
 }
 
 void MainWindow::AddPositionCombo_SelectionChanged(IInspectable const&, SelectionChangedEventArgs const&) {
@@ -252,6 +420,10 @@ void MainWindow::AddStepDialog_PrimaryButtonClick(ContentDialog const&,
   }
 
   m_actions.push_back(action);
+  m_durations.Append(StepDuration(action, &m_blocks));
+  if (HasPosition(action)) {
+    m_clicks.Insert(m_actions.size() - 1, action.x, action.y);
+  }
   m_selectedIndex = static_cast<int>(m_actions.size() - 1);
   UpdateStatus(L"Added step");
   RenderSteps();
@@ -273,13 +445,15 @@ bool MainWindow::TryResolveAddStep(MacroAction& action, std::wstring& error) {
     return true;
   }
 
-  auto buttonTag = GetComboTag(AddButtonCombo());
-  if (buttonTag == L"rightClick") {
-    action.kind = ActionKind::RightClick;
-  } else if (buttonTag == L"otherClick") {
-    action.kind = ActionKind::OtherClick;
-  } else {
-    action.kind = ActionKind::LeftClick;
+  action.kind = ButtonFromTag(GetComboTag(AddButtonCombo()));
+  if (IsRadioChecked(AddTypeBurstRadio())) {
+    if (!TryParseBurst(AddBurstCountBox().Text().c_str(), AddBurstIntervalBox().Text().c_str(), action.count,
+                       action.interval)) {
+      error = L"Enter a valid burst count and interval";
+      return false;
+    }
+    action.button = action.kind;
+    action.kind = ActionKind::Burst;
   }
 
   auto positionTag = GetComboTag(AddPositionCombo());
@@ -314,6 +488,7 @@ bool MainWindow::TryResolveAddStep(MacroAction& action, std::wstring& error) {
 void MainWindow::EditKindCombo_SelectionChanged(IInspectable const&, SelectionChangedEventArgs const&) {
   auto tag = GetComboTag(EditKindCombo());
   EditXYRow().Visibility(tag == L"wait" ? Visibility::Collapsed : Visibility::Visible);
+  EditBurstRow().Visibility(tag == L"burst" ? Visibility::Visible : Visibility::Collapsed);
 }
 
 void MainWindow::ApplyEditButton_Click(IInspectable const&, RoutedEventArgs const&) {
@@ -331,6 +506,16 @@ void MainWindow::ApplyEditButton_Click(IInspectable const&, RoutedEventArgs cons
     return;
   }
 
+  auto& current = m_actions[static_cast<size_t>(m_selectedIndex)];
+  if (current.kind == ActionKind::Call) {
+    current.delay = delay;
+    m_durations.Set(static_cast<size_t>(m_selectedIndex), StepDuration(current, &m_blocks));
+    UpdateStatus(L"Updated step");
+    RenderSteps();
+    UpdateEditPanel();
+    return;
+  }
+
   double x = 0.0;
   double y = 0.0;
   if (kind != ActionKind::Wait) {
@@ -340,31 +525,203 @@ void MainWindow::ApplyEditButton_Click(IInspectable const&, RoutedEventArgs cons
     }
   }
 
+  int count = 0;
+  double interval = 0.0;
+  if (kind == ActionKind::Burst &&
+      !TryParseBurst(EditBurstCountBox().Text().c_str(), EditBurstIntervalBox().Text().c_str(), count, interval)) {
+    UpdateStatus(L"Enter a valid burst count and interval");
+    return;
+  }
+
   auto& action = m_actions[static_cast<size_t>(m_selectedIndex)];
+  const MacroAction before = action;
   action.kind = kind;
   action.delay = delay;
   action.x = x;
   action.y = y;
+  if (kind == ActionKind::Burst) {
+    action.button = ButtonFromTag(GetComboTag(EditBurstButtonCombo()));
+    action.count = count;
+    action.interval = interval;
+  }
+  m_durations.Set(static_cast<size_t>(m_selectedIndex), StepDuration(action, &m_blocks));
+  m_clicks.Update(static_cast<size_t>(m_selectedIndex), before, action);
 
   UpdateStatus(L"Updated step");
   RenderSteps();
   UpdateEditPanel();
 }
 
+void MainWindow::InlineCallButton_Click(IInspectable const&, RoutedEventArgs const&) {
+  if (m_selectedIndex < 0 || m_selectedIndex >= static_cast<int>(m_actions.size()) ||
+      m_actions[static_cast<size_t>(m_selectedIndex)].kind != ActionKind::Call) {
+    UpdateStatus(L"Select a call to inline");
+    return;
+  }
+  auto position = m_actions.begin() + m_selectedIndex;
+  auto steps = InlineCall(*position, m_blocks);
+  if (steps.empty()) {
+    UpdateStatus(L"The called block is missing");
+    return;
+  }
+  size_t count = steps.size();
+  position = m_actions.erase(position);
+  m_actions.insert(position, std::make_move_iterator(steps.begin()), std::make_move_iterator(steps.end()));
+  m_durations.Reset(m_actions, &m_blocks);
+  m_clicks.Reset(m_actions);
+  m_regionSelection.clear();
+  m_regionMask.clear();
+  m_regionBlockClicks = 0;
+  UpdateStatus(L"Inlined " + std::to_wstring(count) + L" steps");
+  RenderSteps();
+  UpdateEditPanel();
+}
+
 void MainWindow::DeleteStepButton_Click(IInspectable const&, RoutedEventArgs const&) {
   if (m_selectedIndex < 0 || m_selectedIndex >= static_cast<int>(m_actions.size())) {
     UpdateStatus(L"Select a step to delete");
     return;
   }
   m_actions.erase(m_actions.begin() + m_selectedIndex);
+  m_durations.Erase(static_cast<size_t>(m_selectedIndex));
+  m_clicks.Reset(m_actions);
+  m_regionSelection.clear();
+  m_regionMask.clear();
+  m_regionBlockClicks = 0;
   m_selectedIndex = -1;
   UpdateStatus(L"Deleted step");
   RenderSteps();
   UpdateEditPanel();
 }
 
+bool MainWindow::TryReadRegion(double& left, double& top, double& right, double& bottom) {
+  return TryParseSigned(RegionLeftBox().Text().c_str(), left) && TryParseSigned(RegionTopBox().Text().c_str(), top) &&
+         TryParseSigned(RegionRightBox().Text().c_str(), right) &&
+         TryParseSigned(RegionBottomBox().Text().c_str(), bottom);
+}
+
+void MainWindow::SetRegionSelection(std::vector<size_t> selection, const ClickRegion& region, size_t blockClicks) {
+  m_regionSelection = std::move(selection);
+  m_region = region;
+  m_regionBlockClicks = blockClicks;
+  m_regionMask.assign(m_actions.size(), 0);
+  for (size_t index : m_regionSelection) {
+    m_regionMask[index] = 1;
+  }
+  if (m_regionSelection.empty() && m_regionBlockClicks == 0) {
+    RegionSelectionText().Text(L"No clicks selected.");
+    return;
+  }
+  std::wstring text = std::to_wstring(m_regionSelection.size()) + L" clicks selected";
+  if (m_regionBlockClicks > 0) {
+    text += L" (+" + std::to_wstring(m_regionBlockClicks) + L" inside shared blocks)";
+  }
+  RegionSelectionText().Text(text + L".");
+}
+
+void MainWindow::RegionSelect_Click(IInspectable const&, RoutedEventArgs const&) {
+  double left = 0.0;
+  double top = 0.0;
+  double right = 0.0;
+  double bottom = 0.0;
+  if (!TryReadRegion(left, top, right, bottom)) {
+    UpdateStatus(L"Enter a valid region");
+    return;
+  }
+  ClickRegion region{left, top, right, bottom};
+  SetRegionSelection(m_clicks.QueryRegion(left, top, right, bottom), region,
+                     CountBlockClicksInRegion(m_actions, m_blocks, region));
+  UpdateStatus(L"Selected region");
+  RenderSteps();
+}
+
+void MainWindow::RegionNearest_Click(IInspectable const&, RoutedEventArgs const&) {
+  double x = 0.0;
+  double y = 0.0;
+  if (!TryParseSigned(RegionLeftBox().Text().c_str(), x) || !TryParseSigned(RegionTopBox().Text().c_str(), y)) {
+    UpdateStatus(L"Enter a valid point in Left and Top");
+    return;
+  }
+  size_t index = 0;
+  bool haveClick = m_clicks.Nearest(x, y, index);
+  size_t callIndex = 0;
+  double blockDistance = 0.0;
+  bool haveBlockClick = NearestBlockClick(m_actions, m_blocks, x, y, callIndex, blockDistance);
+  if (!haveClick && !haveBlockClick) {
+    UpdateStatus(L"No clicks to search");
+    return;
+  }
+  if (haveBlockClick) {
+    double dx = haveClick ? m_actions[index].x - x : 0.0;
+    double dy = haveClick ? m_actions[index].y - y : 0.0;
+    if (!haveClick || blockDistance < dx * dx + dy * dy) {
+      SelectRow(callIndex);
+      UpdateStatus(L"Nearest click is inside the call at step " + std::to_wstring(callIndex + 1));
+      return;
+    }
+  }
+  SelectRow(index);
+  UpdateStatus(L"Selected nearest click");
+}
+
+void MainWindow::RegionTransform_Click(IInspectable const&, RoutedEventArgs const&) {
+  if (m_regionSelection.empty() && m_regionBlockClicks == 0) {
+    UpdateStatus(L"Select a region first");
+    return;
+  }
+
+  double dx = 0.0;
+  double dy = 0.0;
+  double scale = 1.0;
+  auto dxText = std::wstring(RegionDxBox().Text().c_str());
+  auto dyText = std::wstring(RegionDyBox().Text().c_str());
+  auto scaleText = std::wstring(RegionScaleBox().Text().c_str());
+  if ((!dxText.empty() && !TryParseSigned(dxText, dx)) || (!dyText.empty() && !TryParseSigned(dyText, dy)) ||
+      (!scaleText.empty() && !TryParseDouble(scaleText, scale, false))) {
+    UpdateStatus(L"Enter a valid offset and scale");
+    return;
+  }
+
+  double originX = std::min(m_region.left, m_region.right);
+  double originY = std::min(m_region.top, m_region.bottom);
+  m_clicks.Transform(m_actions, m_regionSelection, dx, dy, scale, originX, originY);
+  size_t blockClicks = TransformBlockClicks(m_actions, m_blocks, m_region, dx, dy, scale, originX, originY);
+  std::wstring status = L"Moved " + std::to_wstring(m_regionSelection.size()) + L" clicks";
+  if (blockClicks > 0) {
+    status += L" and " + std::to_wstring(blockClicks) + L" clicks inside blocks";
+  }
+  UpdateStatus(status);
+  RenderSteps();
+  UpdateEditPanel();
+}
+
+void MainWindow::RegionBenchmark_Click(IInspectable const&, RoutedEventArgs const&) {
+  UpdateStatus(L"Benchmarking region queries...");
+  auto dispatcher = DispatcherQueue();
+  auto weak = get_weak();
+  std::thread worker([dispatcher, weak]() {
+    auto result = RunSpatialBenchmark(1'000'000, 10'000);
+    std::wstringstream status;
+    status << std::fixed << std::setprecision(1) << result.points << L" clicks: build " << result.buildMillis
+           << L" ms, region " << std::setprecision(2) << result.regionMicros << L" us, nearest " << result.nearestMicros
+           << L" us, translate " << std::setprecision(1) << result.translateMillis << L" ms";
+    dispatcher.TryEnqueue([weak, text = status.str()]() {
+      if (auto self = weak.get()) {
+        self->UpdateStatus(text);
+      }
+    });
+  });
+  worker.detach();
+}
+
 void MainWindow::ClearStepsButton_Click(IInspectable const&, RoutedEventArgs const&) {
   m_actions.clear();
+  m_blocks.clear();
+  m_durations.Clear();
+  m_clicks.Clear();
+  m_regionSelection.clear();
+  m_regionMask.clear();
+  m_regionBlockClicks = 0;
   m_selectedIndex = -1;
   UpdateStatus(L"Ready");
   RenderSteps();
@@ -390,41 +747,95 @@ void MainWindow::StartPlayback() {
 
   m_stopRequested = false;
   m_isPlaying = true;
+  m_burstSummary.clear();
   PlayButton().Content(box_value(L"Stop"));
 
   const bool loop = LoopToggle().IsOn();
   UpdateStatus(loop ? L"Looping macro" : L"Playing macro");
 
   auto actionsCopy = m_actions;
+  auto blocksCopy = m_blocks;
   auto dispatcher = DispatcherQueue();
   auto weak = get_weak();
+  StartProgressTimer(false);
 
-  std::thread worker([this, actionsCopy, loop, dispatcher, weak]() mutable {
+  std::thread worker([this, actionsCopy, blocksCopy, loop, dispatcher, weak]() mutable {
+    uint32_t iteration = 0;
     do {
-      for (const auto& action : actionsCopy) {
-        if (m_stopRequested.load()) {
-          break;
-        }
-        if (action.delay > 0) {
-          std::this_thread::sleep_for(std::chrono::duration<double>(action.delay));
-        }
-        if (m_stopRequested.load()) {
+      m_playbackLoop.store(iteration++, std::memory_order_relaxed);
+      for (size_t i = 0; i < actionsCopy.size(); ++i) {
+        if (!PlayStep(actionsCopy[i], i, blocksCopy, dispatcher)) {
           break;
         }
-        if (action.kind != ActionKind::Wait) {
-          PerformAction(action);
-        }
       }
     } while (loop && !m_stopRequested.load());
 
     bool stopped = m_stopRequested.load();
     dispatcher.TryEnqueue([weak, loop, stopped]() {
       if (auto self = weak.get()) {
-        self->m_isPlaying = false;
-        self->PlayButton().Content(box_value(L"Play"));
-        if (!stopped) {
-          self->UpdateStatus(loop ? L"Loop finished" : L"Finished playback");
+        self->OnPlaybackFinished(loop, stopped, {});
+      }
+    });
+  });
+
+  m_playbackThread = std::move(worker);
+  m_playbackThread.detach();
+}
+
+void MainWindow::StartStreamingPlayback(std::wstring path) {
+  if (m_isPlaying) {
+    return;
+  }
+
+  m_stopRequested = false;
+  m_isPlaying = true;
+  m_burstSummary.clear();
+  PlayButton().Content(box_value(L"Stop"));
+
+  const bool loop = LoopToggle().IsOn();
+  UpdateStatus(loop ? L"Looping streamed macro" : L"Streaming macro");
+
+  auto dispatcher = DispatcherQueue();
+  auto weak = get_weak();
+  StartProgressTimer(true);
+
+  std::thread worker([this, path = std::move(path), loop, dispatcher, weak]() {
+    ProcessMemorySampler memory;
+    MacroStreamReader reader(path);
+    std::wstringstream summary;
+    if (!reader.Open()) {
+      summary << L"Couldn't stream file";
+    } else {
+      uint32_t iteration = 0;
+      do {
+        m_playbackLoop.store(iteration++, std::memory_order_relaxed);
+        size_t step = 0;
+        while (const MacroAction* action = reader.Next()) {
+          if (!PlayStep(*action, step++, reader.Blocks(), dispatcher)) {
+            break;
+          }
+        }
+        if (!loop || m_stopRequested.load() || reader.Failed() || reader.StepsRead() == 0) {
+          break;
         }
+        reader.Rewind();
+      } while (true);
+
+      constexpr size_t kMegabyte = 1024 * 1024;
+      auto baseline = memory.Baseline();
+      auto peak = memory.Peak();
+      summary << (reader.Failed() ? L"Stream stopped on invalid step after " : L"Streamed ")
+              << reader.StepsRead() << L" steps; process peak " << peak.workingSetBytes / kMegabyte
+              << L" MB working set (+" << (peak.workingSetBytes - baseline.workingSetBytes) / kMegabyte << L"), "
+              << peak.privateBytes / kMegabyte << L" MB private (+"
+              << (peak.privateBytes - baseline.privateBytes) / kMegabyte << L"); reader buffers "
+              << reader.PeakMemoryBytes() / 1024 << L" KB, " << reader.StarvedCount() << L" prefetch stalls";
+    }
+
+    bool stopped = m_stopRequested.load();
+    dispatcher.TryEnqueue([weak, loop, stopped, text = summary.str()]() {
+      if (auto self = weak.get()) {
+        self->OnPlaybackFinished(loop, stopped, text);
       }
     });
   });
@@ -433,42 +844,99 @@ void MainWindow::StartPlayback() {
   m_playbackThread.detach();
 }
 
+void MainWindow::OnPlaybackFinished(bool loop, bool stopped, std::wstring summary) {
+  m_isPlaying = false;
+  if (m_progressTimer) {
+    m_progressTimer.Stop();
+  }
+  PlayButton().Content(box_value(L"Play"));
+  if (stopped) {
+    return;
+  }
+  if (summary.empty()) {
+    summary = loop ? L"Loop finished" : L"Finished playback";
+  }
+  if (!m_burstSummary.empty()) {
+    summary += L" | " + m_burstSummary;
+  }
+  UpdateStatus(summary);
+}
+
+bool MainWindow::PlayStep(const MacroAction& action, size_t stepIndex, const BlockTable& blocks,
+                          winrt::Microsoft::UI::Dispatching::DispatcherQueue const& dispatcher, int depth) {
+  TRACE_ZONE("PlaybackStep");
+  if (m_stopRequested.load()) {
+    return false;
+  }
+  // Steps inside a block count toward their Call, so progress only tracks the top level.
+  if (depth == 0) {
+    m_playbackStep.store(stepIndex, std::memory_order_relaxed);
+    m_stepStartedAt.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+  }
+  if (action.delay > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(action.delay));
+  }
+  if (m_stopRequested.load()) {
+    return false;
+  }
+
+  if (action.kind == ActionKind::Call) {
+    auto block = blocks.find(action.block);
+    if (block == blocks.end() || depth >= kMaxCallDepth) {
+      return true;
+    }
+    for (int i = 0; i < action.repeat; ++i) {
+      for (const auto& inner : *block->second) {
+        if (!PlayStep(inner, stepIndex, blocks, dispatcher, depth + 1)) {
+          return false;
+        }
+      }
+    }
+  } else if (action.kind == ActionKind::Burst) {
+    auto stats = SendBurst(action, m_stopRequested);
+    std::wstringstream text;
+    text << L"Burst " << stats.clicks << L" clicks at " << std::fixed << std::setprecision(0) << stats.clicksPerSecond
+         << L"/s, jitter " << std::setprecision(1) << stats.meanJitterMicros << L" us avg, " << stats.maxJitterMicros
+         << L" us max";
+    dispatcher.TryEnqueue([weak = get_weak(), summary = text.str()]() {
+      if (auto self = weak.get()) {
+        self->m_burstSummary = summary;
+        self->UpdateStatus(summary);
+      }
+    });
+  } else if (action.kind != ActionKind::Wait) {
+    PerformAction(action);
+  }
+  return true;
+}
+
 void MainWindow::StopPlayback(std::wstring_view statusOverride) {
   m_stopRequested = true;
   m_isPlaying = false;
+  if (m_progressTimer) {
+    m_progressTimer.Stop();
+  }
   PlayButton().Content(box_value(L"Play"));
   UpdateStatus(statusOverride);
 }
 
 void MainWindow::PerformAction(const MacroAction& action) {
-  int x = static_cast<int>(action.x);
-  int y = static_cast<int>(action.y);
-  SetCursorPos(x, y);
-
-  DWORD downFlag = MOUSEEVENTF_LEFTDOWN;
-  DWORD upFlag = MOUSEEVENTF_LEFTUP;
-  if (action.kind == ActionKind::RightClick) {
-    downFlag = MOUSEEVENTF_RIGHTDOWN;
-    upFlag = MOUSEEVENTF_RIGHTUP;
-  } else if (action.kind == ActionKind::OtherClick) {
-    downFlag = MOUSEEVENTF_MIDDLEDOWN;
-    upFlag = MOUSEEVENTF_MIDDLEUP;
-  }
-
-  INPUT inputs[2]{};
-  inputs[0].type = INPUT_MOUSE;
-  inputs[0].mi.dwFlags = downFlag;
-  inputs[1].type = INPUT_MOUSE;
-  inputs[1].mi.dwFlags = upFlag;
-  SendInput(2, inputs, sizeof(INPUT));
+  TRACE_ZONE("PerformAction");
+  SendClick(action);
 }
 
 void MainWindow::OnPanicHotkey() {
   DispatcherQueue().TryEnqueue([this]() {
+    // Macros started over the pipe inject clicks too, so the panic key stops them as well.
+    bool serviceStopped = m_service && m_service->StopPlayback();
     if (m_isPlaying) {
       StopPlayback(L"Emergency stop");
       return;
     }
+    if (serviceStopped) {
+      UpdateStatus(L"Emergency stop (service)");
+      return;
+    }
     if (m_actions.empty()) {
       UpdateStatus(L"Nothing to play");
       return;
@@ -480,6 +948,12 @@ void MainWindow::OnPanicHotkey() {
 
 void MainWindow::FileNew_Click(IInspectable const&, RoutedEventArgs const&) {
   m_actions.clear();
+  m_blocks.clear();
+  m_durations.Clear();
+  m_clicks.Clear();
+  m_regionSelection.clear();
+  m_regionMask.clear();
+  m_regionBlockClicks = 0;
   m_selectedIndex = -1;
   m_currentFilePath.clear();
   m_fileName = L"Untitled.emacro";
@@ -497,25 +971,110 @@ winrt::fire_and_forget MainWindow::OpenFileAsync() {
   auto initializeWithWindow = picker.as<IInitializeWithWindow>();
   initializeWithWindow->Initialize(m_hwnd);
 
-  StorageFile file = co_await picker.PickSingleFileAsync();
+  StorageFile file{ nullptr };
+  {
+    TRACE_ZONE("OpenFilePicker");
+    file = co_await picker.PickSingleFileAsync();
+  }
   if (!file) {
     co_return;
   }
 
-  auto text = co_await FileIO::ReadTextAsync(file);
-  try {
-    JsonArray array = JsonArray::Parse(text);
-    m_actions = ParseActionsFromJson(array);
-    m_selectedIndex = -1;
-    m_currentFilePath = file.Path().c_str();
-    m_fileName = file.Name().c_str();
-    UpdateStatus(L"Loaded steps");
-    UpdateFileName();
-    RenderSteps();
-    UpdateEditPanel();
-  } catch (...) {
-    UpdateStatus(L"Couldn't open file");
+  OpenMacroPath(file.Path().c_str(), false);
+}
+
+void MainWindow::OpenMacroPath(std::wstring path, bool startup) {
+  if (!startup) {
+    UpdateStatus(L"Opening macro...");
+  }
+  auto dispatcher = DispatcherQueue();
+  auto weak = get_weak();
+  std::thread worker([path = std::move(path), startup, dispatcher, weak]() {
+    winrt::init_apartment(winrt::apartment_type::multi_threaded);
+    auto document = std::make_shared<MacroDocument>();
+    auto result = OpenMacroCached(path, *document);
+    dispatcher.TryEnqueue([weak, path, document, result, startup]() {
+      if (auto self = weak.get()) {
+        self->ApplyOpenedMacro(path, std::move(*document), result, startup);
+      }
+    });
+  });
+  worker.detach();
+}
+
+void MainWindow::ApplyOpenedMacro(const std::wstring& path, MacroDocument document, const MacroOpenResult& result,
+                                  bool startup) {
+  if (!result.ok) {
+    // Only a file that is gone leaves the list; a locked file or an offline
+    // share may open fine next time.
+    if (result.missing && std::find(m_recent.begin(), m_recent.end(), path) != m_recent.end()) {
+      ForgetRecentMacro(m_recent, path);
+      SaveRecentMacros(m_recent);
+      RebuildRecentMenu();
+    }
+    if (!startup) {
+      UpdateStatus(L"Couldn't open file");
+    }
+    return;
+  }
+  // The startup preload must not replace anything the user has begun in the meantime.
+  if (startup && (m_isPlaying || !m_actions.empty() || !m_currentFilePath.empty())) {
+    return;
+  }
+
+  m_actions = std::move(document.steps);
+  m_blocks = std::move(document.blocks);
+  m_durations.Reset(m_actions, &m_blocks);
+  m_clicks.Reset(m_actions);
+  m_regionSelection.clear();
+  m_regionMask.clear();
+  m_regionBlockClicks = 0;
+  m_selectedIndex = -1;
+  m_currentFilePath = path;
+  m_fileName = std::filesystem::path(path).filename().wstring();
+  TouchRecentMacro(m_recent, path);
+  SaveRecentMacros(m_recent);
+  RebuildRecentMenu();
+
+  std::wstringstream status;
+  status << (startup ? L"Restored " : L"Loaded ") << ExpandedStepCount(m_actions, m_blocks) << L" steps in "
+         << std::fixed << std::setprecision(1) << result.millis << L" ms";
+  if (result.warm) {
+    status << L" from cache";
+    if (result.coldMillis > 0.0) {
+      status << L" (full parse " << result.coldMillis << L" ms)";
+    }
+  } else if (!m_blocks.empty()) {
+    const size_t savedBytes = winrt::to_string(SerializeMacroDocument(m_actions, m_blocks)).size();
+    status << L" using " << m_blocks.size() << L" shared blocks: " << result.dedup.stepsBefore << L" -> "
+           << result.dedup.stepsAfter << L" resident steps ("
+           << result.dedup.stepsBefore * sizeof(MacroAction) / 1024 << L" -> "
+           << result.dedup.stepsAfter * sizeof(MacroAction) / 1024 << L" KB), file " << result.fileBytes / 1024
+           << L" -> " << savedBytes / 1024 << L" KB on save";
   }
+  UpdateStatus(status.str());
+  UpdateFileName();
+  RenderSteps();
+  UpdateEditPanel();
+}
+
+void MainWindow::RebuildRecentMenu() {
+  auto items = RecentMenu().Items();
+  items.Clear();
+  for (const auto& path : m_recent) {
+    MenuFlyoutItem item;
+    item.Text(std::filesystem::path(path).filename().wstring());
+    ToolTipService::SetToolTip(item, box_value(winrt::hstring(path)));
+    item.Click([this, path](auto&&, auto&&) {
+      if (m_isPlaying) {
+        UpdateStatus(L"Stop playback first");
+        return;
+      }
+      OpenMacroPath(path, false);
+    });
+    items.Append(item);
+  }
+  RecentMenu().IsEnabled(!m_recent.empty());
 }
 
 winrt::fire_and_forget MainWindow::SaveFileAsync(bool asNew) {
@@ -532,7 +1091,10 @@ winrt::fire_and_forget MainWindow::SaveFileAsync(bool asNew) {
       auto initializeWithWindow = picker.as<IInitializeWithWindow>();
       initializeWithWindow->Initialize(m_hwnd);
 
-      file = co_await picker.PickSaveFileAsync();
+      {
+        TRACE_ZONE("SaveFilePicker");
+        file = co_await picker.PickSaveFileAsync();
+      }
       if (!file) {
         co_return;
       }
@@ -540,10 +1102,16 @@ winrt::fire_and_forget MainWindow::SaveFileAsync(bool asNew) {
       file = co_await StorageFile::GetFileFromPathAsync(m_currentFilePath);
     }
 
-    JsonArray array = SerializeActionsToJson(m_actions);
-    co_await FileIO::WriteTextAsync(file, array.Stringify());
+    co_await FileIO::WriteTextAsync(file, SerializeMacroDocument(m_actions, m_blocks));
     m_currentFilePath = file.Path().c_str();
     m_fileName = file.Name().c_str();
+    TouchRecentMacro(m_recent, m_currentFilePath);
+    SaveRecentMacros(m_recent);
+    RebuildRecentMenu();
+
+    // Saving changes the file's mtime and hash, so refresh the snapshot rather than leave it stale.
+    auto document = std::make_shared<MacroDocument>(MacroDocument{m_actions, m_blocks});
+    std::thread([path = m_currentFilePath, document]() { SaveMacroSnapshot(path, *document, 0.0); }).detach();
     UpdateStatus(L"Saved macro");
     UpdateFileName();
   } catch (...) {
@@ -551,6 +1119,167 @@ winrt::fire_and_forget MainWindow::SaveFileAsync(bool asNew) {
   }
 }
 
+void MainWindow::SetServiceRunning(bool running) {
+  if (running) {
+    if (!m_service) {
+      m_service = std::make_unique<MacroService>();
+    }
+    bool started = m_service->Start();
+    UpdateStatus(started ? L"Macro service listening" : L"Couldn't start macro service");
+  } else if (m_service) {
+    m_service->Stop();
+    UpdateStatus(L"Macro service stopped");
+  }
+  ServiceToggleItem().IsChecked(m_service && m_service->IsRunning());
+}
+
+void MainWindow::ServiceToggle_Click(IInspectable const&, RoutedEventArgs const&) {
+  SetServiceRunning(ServiceToggleItem().IsChecked());
+}
+
+void MainWindow::ServiceBenchmark_Click(IInspectable const&, RoutedEventArgs const&) {
+  if (!m_service || !m_service->IsRunning()) {
+    UpdateStatus(L"Start the macro service first");
+    return;
+  }
+  UpdateStatus(L"Benchmarking service...");
+
+  auto dispatcher = DispatcherQueue();
+  auto weak = get_weak();
+  std::thread worker([dispatcher, weak]() {
+    auto latency = RunServiceBenchmark(1, 5000);
+    auto throughput = RunServiceBenchmark(8, 5000);
+    std::wstringstream status;
+    status << std::fixed << std::setprecision(1) << L"Service round trip p50 " << latency.p50Micros << L" us, p99 "
+           << latency.p99Micros << L" us; " << std::setprecision(0) << throughput.callsPerSecond
+           << L" calls/s across 8 clients";
+    if (latency.failures + throughput.failures > 0) {
+      status << L" (" << latency.failures + throughput.failures << L" failed)";
+    }
+    dispatcher.TryEnqueue([weak, text = status.str()]() {
+      if (auto self = weak.get()) {
+        self->UpdateStatus(text);
+      }
+    });
+  });
+  worker.detach();
+}
+
+void MainWindow::TraceToggle_Click(IInspectable const&, RoutedEventArgs const&) {
+  bool enabled = TraceToggleItem().IsChecked();
+  SetTraceEnabled(enabled);
+  UpdateStatus(enabled ? L"Tracing enabled" : L"Tracing disabled");
+}
+
+void MainWindow::TraceExport_Click(IInspectable const&, RoutedEventArgs const&) {
+  ExportTraceAsync();
+}
+
+winrt::fire_and_forget MainWindow::ExportTraceAsync() {
+  auto lifetime = get_strong();
+
+  FileSavePicker picker;
+  picker.FileTypeChoices().Insert(L"Chrome Trace", single_threaded_vector<hstring>({ L".json" }));
+  picker.SuggestedFileName(L"easymacro-trace.json");
+  picker.DefaultFileExtension(L".json");
+  auto initializeWithWindow = picker.as<IInitializeWithWindow>();
+  initializeWithWindow->Initialize(m_hwnd);
+
+  StorageFile file = co_await picker.PickSaveFileAsync();
+  if (!file) {
+    co_return;
+  }
+  UpdateStatus(ExportTraceJson(file.Path().c_str()) ? L"Exported trace" : L"Failed to export trace");
+}
+
+winrt::fire_and_forget MainWindow::LibraryFolderAsync(std::optional<BatchMode> batchMode, bool benchmark) {
+  auto lifetime = get_strong();
+  if (m_libraryBusy.load()) {
+    UpdateStatus(L"Library task already running");
+    co_return;
+  }
+
+  FolderPicker picker;
+  picker.FileTypeFilter().Append(L"*");
+  auto initializeWithWindow = picker.as<IInitializeWithWindow>();
+  initializeWithWindow->Initialize(m_hwnd);
+
+  StorageFolder folder = co_await picker.PickSingleFolderAsync();
+  if (!folder) {
+    co_return;
+  }
+
+  std::wstring path = folder.Path().c_str();
+  if (!m_library || m_library->Folder() != path) {
+    m_library = std::make_shared<MacroLibrary>(path);
+  }
+
+  m_libraryBusy = true;
+  UpdateStatus(batchMode ? L"Processing folder..." : benchmark ? L"Benchmarking scan..." : L"Indexing folder...");
+
+  auto library = m_library;
+  auto dispatcher = DispatcherQueue();
+  auto weak = get_weak();
+  std::thread worker([library, batchMode, benchmark, dispatcher, weak]() {
+    winrt::init_apartment(winrt::apartment_type::multi_threaded);
+    std::wstringstream status;
+    if (batchMode) {
+      auto result = library->RunBatch(*batchMode);
+      status << (*batchMode == BatchMode::Validate    ? L"Validated "
+                 : *batchMode == BatchMode::Normalize ? L"Normalized "
+                                                      : L"Measured ")
+             << (result.processed - result.failed) << L" of " << result.processed << L" macros";
+      if (*batchMode == BatchMode::Deduplicate) {
+        status << L": " << result.stepsBefore << L" -> " << result.stepsAfter << L" resident steps, "
+               << result.bytesBefore / 1024 << L" -> " << result.bytesAfter / 1024 << L" KB on disk";
+      }
+      if (!result.failures.empty()) {
+        status << L" (first failure: " << std::filesystem::path(result.failures.front()).filename().wstring()
+               << L")";
+      }
+    } else if (benchmark) {
+      auto results = library->BenchmarkScan();
+      status << L"Cold scan of " << (results.empty() ? 0 : results.front().files) << L" macros:" << std::fixed
+             << std::setprecision(0);
+      for (const auto& run : results) {
+        status << L" " << run.threads << (run.threads == 1 ? L" thread " : L" threads ") << run.filesPerSecond
+               << L" files/s" << (&run == &results.back() ? L"" : L",");
+      }
+    } else {
+      auto result = library->Scan();
+      status << L"Indexed " << result.total << L" macros (" << result.reparsed << L" updated, " << result.invalid
+             << L" invalid) in " << std::fixed << std::setprecision(2) << result.elapsedSeconds << L"s";
+    }
+    dispatcher.TryEnqueue([weak, text = status.str()]() {
+      if (auto self = weak.get()) {
+        self->m_libraryBusy = false;
+        self->UpdateStatus(text);
+      }
+    });
+  });
+  worker.detach();
+}
+
+void MainWindow::LibraryIndex_Click(IInspectable const&, RoutedEventArgs const&) {
+  LibraryFolderAsync(std::nullopt);
+}
+
+void MainWindow::LibraryValidate_Click(IInspectable const&, RoutedEventArgs const&) {
+  LibraryFolderAsync(BatchMode::Validate);
+}
+
+void MainWindow::LibraryNormalize_Click(IInspectable const&, RoutedEventArgs const&) {
+  LibraryFolderAsync(BatchMode::Normalize);
+}
+
+void MainWindow::LibraryDedup_Click(IInspectable const&, RoutedEventArgs const&) {
+  LibraryFolderAsync(BatchMode::Deduplicate);
+}
+
+void MainWindow::LibraryBenchmark_Click(IInspectable const&, RoutedEventArgs const&) {
+  LibraryFolderAsync(std::nullopt, true);
+}
+
 void MainWindow::FileOpen_Click(IInspectable const&, RoutedEventArgs const&) {
   OpenFileAsync();
 }
@@ -559,6 +1288,29 @@ void MainWindow::FileSave_Click(IInspectable const&, RoutedEventArgs const&) {
   SaveFileAsync(false);
 }
 
+winrt::fire_and_forget MainWindow::PlayStreamAsync() {
+  auto lifetime = get_strong();
+  if (m_isPlaying) {
+    UpdateStatus(L"Stop playback first");
+    co_return;
+  }
+
+  FileOpenPicker picker;
+  picker.FileTypeFilter().Append(L".emacro");
+  auto initializeWithWindow = picker.as<IInitializeWithWindow>();
+  initializeWithWindow->Initialize(m_hwnd);
+
+  StorageFile file = co_await picker.PickSingleFileAsync();
+  if (!file) {
+    co_return;
+  }
+  StartStreamingPlayback(file.Path().c_str());
+}
+
+void MainWindow::FilePlayStream_Click(IInspectable const&, RoutedEventArgs const&) {
+  PlayStreamAsync();
+}
+
 void MainWindow::FileSaveAs_Click(IInspectable const&, RoutedEventArgs const&) {
   SaveFileAsync(true);
 }
@@ -2,9 +2,19 @@
 
 #include "MainWindow.g.h"
 #include "MacroAction.h"
+#include "MacroBlocks.h"
+#include "DurationIndex.h"
 #include "HotkeyManager.h"
+#include "MacroLibrary.h"
+#include "MacroService.h"
+#include "RecentCache.h"
+#include "SpatialIndex.h"
+
+#include <winrt/Microsoft.UI.Dispatching.h>
 
 #include <atomic>
+#include <memory>
+#include <optional>
 #include <thread>
 #include <vector>
 
@@ -24,6 +34,34 @@ struct MainWindow : MainWindowT<MainWindow> {
                       winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
   void FileSaveAs_Click(winrt::Windows::Foundation::IInspectable const&,
                         winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void FilePlayStream_Click(winrt::Windows::Foundation::IInspectable const&,
+                            winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void LibraryIndex_Click(winrt::Windows::Foundation::IInspectable const&,
+                          winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void LibraryValidate_Click(winrt::Windows::Foundation::IInspectable const&,
+                             winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void LibraryNormalize_Click(winrt::Windows::Foundation::IInspectable const&,
+                              winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void LibraryDedup_Click(winrt::Windows::Foundation::IInspectable const&,
+                          winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void LibraryBenchmark_Click(winrt::Windows::Foundation::IInspectable const&,
+                              winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void TraceToggle_Click(winrt::Windows::Foundation::IInspectable const&,
+                         winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void TraceExport_Click(winrt::Windows::Foundation::IInspectable const&,
+                         winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void ServiceToggle_Click(winrt::Windows::Foundation::IInspectable const&,
+                           winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void ServiceBenchmark_Click(winrt::Windows::Foundation::IInspectable const&,
+                              winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void RegionSelect_Click(winrt::Windows::Foundation::IInspectable const&,
+                          winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void RegionNearest_Click(winrt::Windows::Foundation::IInspectable const&,
+                           winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void RegionTransform_Click(winrt::Windows::Foundation::IInspectable const&,
+                             winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void RegionBenchmark_Click(winrt::Windows::Foundation::IInspectable const&,
+                             winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
   void ClearStepsButton_Click(winrt::Windows::Foundation::IInspectable const&,
                               winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
   void AddStepDialog_PrimaryButtonClick(winrt::Microsoft::UI::Xaml::Controls::ContentDialog const&,
@@ -36,33 +74,73 @@ struct MainWindow : MainWindowT<MainWindow> {
                                       winrt::Microsoft::UI::Xaml::Controls::SelectionChangedEventArgs const&);
   void ApplyEditButton_Click(winrt::Windows::Foundation::IInspectable const&,
                              winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
+  void InlineCallButton_Click(winrt::Windows::Foundation::IInspectable const&,
+                              winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
   void DeleteStepButton_Click(winrt::Windows::Foundation::IInspectable const&,
                               winrt::Microsoft::UI::Xaml::RoutedEventArgs const&);
 
  private:
   void InitializeDefaults();
+  void ApplyCommandLine();
   void RenderSteps();
   void UpdateEditPanel();
   void UpdateFileName();
   void UpdateStatus(std::wstring_view status);
+  void UpdateDurationText();
+  void UpdatePlaybackProgress();
+  void StartProgressTimer(bool streaming);
   void StartPlayback();
+  void StartStreamingPlayback(std::wstring path);
+  void OnPlaybackFinished(bool loop, bool stopped, std::wstring summary);
   void StopPlayback(std::wstring_view statusOverride = L"Playback stopped");
+  bool PlayStep(const MacroAction& action, size_t stepIndex, const BlockTable& blocks,
+                winrt::Microsoft::UI::Dispatching::DispatcherQueue const& dispatcher, int depth = 0);
   void PerformAction(const MacroAction& action);
   void OnPanicHotkey();
+  void SetServiceRunning(bool running);
   void SelectRow(size_t index);
+  void SetRegionSelection(std::vector<size_t> selection, const ClickRegion& region = {}, size_t blockClicks = 0);
+  bool TryReadRegion(double& left, double& top, double& right, double& bottom);
   bool TryResolveAddStep(MacroAction& action, std::wstring& error);
+  void OpenMacroPath(std::wstring path, bool startup);
+  void ApplyOpenedMacro(const std::wstring& path, MacroDocument document, const MacroOpenResult& result,
+                        bool startup);
+  void RebuildRecentMenu();
   winrt::fire_and_forget OpenFileAsync();
   winrt::fire_and_forget SaveFileAsync(bool asNew);
+  winrt::fire_and_forget PlayStreamAsync();
+  winrt::fire_and_forget ExportTraceAsync();
+  winrt::fire_and_forget LibraryFolderAsync(std::optional<BatchMode> batchMode, bool benchmark = false);
 
   HWND m_hwnd = nullptr;
   HotkeyManager m_hotkey{};
   std::vector<MacroAction> m_actions{};
+  BlockTable m_blocks{};
+  DurationIndex m_durations{};
+  SpatialIndex m_clicks{};
+  std::vector<size_t> m_regionSelection{};
+  std::vector<char> m_regionMask{};
+  // Region the selection was made from; Transform moves exactly what Select found.
+  ClickRegion m_region{};
+  // Clicks inside blocks that fall in the selected region; blocks are edited copy-on-write.
+  size_t m_regionBlockClicks = 0;
   int m_selectedIndex = -1;
   bool m_isPlaying = false;
   std::atomic<bool> m_stopRequested{false};
   std::thread m_playbackThread{};
+  std::atomic<size_t> m_playbackStep{0};
+  std::atomic<uint32_t> m_playbackLoop{0};
+  std::atomic<int64_t> m_stepStartedAt{0};
+  bool m_isStreaming = false;
+  winrt::Microsoft::UI::Dispatching::DispatcherQueueTimer m_progressTimer{ nullptr };
   std::wstring m_currentFilePath{};
   std::wstring m_fileName = L"Untitled.emacro";
+  std::wstring m_traceOutputPath{};
+  std::wstring m_burstSummary{};
+  std::vector<std::wstring> m_recent{};
+  std::unique_ptr<MacroService> m_service{};
+  std::shared_ptr<MacroLibrary> m_library{};
+  std::atomic<bool> m_libraryBusy{false};
 };
 }
 
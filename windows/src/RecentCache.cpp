@@ -0,0 +1,411 @@
+#include "pch.h"
+#include "RecentCache.h"
+#include "MacroLibrary.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+using winrt::Windows::Data::Json::JsonArray;
+using winrt::Windows::Data::Json::JsonValue;
+
+namespace {
+constexpr uint32_t kSnapshotMagic = 0x43524d45;  // "EMRC"
+constexpr uint32_t kSnapshotVersion = 1;
+
+#pragma pack(push, 1)
+struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  int64_t modifiedTime;
+  uint64_t fileSize;
+  uint64_t contentHash;
+  double coldMillis;
+  uint32_t stepCount;
+  uint32_t blockCount;
+  // Top-level steps first, then each block's steps back to back.
+  uint32_t actionCount;
+  uint32_t stringBytes;
+};
+
+struct SnapshotBlock {
+  uint32_t idOffset;
+  uint32_t idLength;
+  uint32_t firstAction;
+  uint32_t actionCount;
+};
+
+struct SnapshotAction {
+  double delay;
+  double x;
+  double y;
+  double interval;
+  int32_t count;
+  int32_t repeat;
+  uint8_t kind;
+  uint8_t button;
+  uint16_t reserved;
+  uint32_t idOffset;
+  uint32_t idLength;
+  uint32_t blockOffset;
+  uint32_t blockLength;
+};
+#pragma pack(pop)
+
+struct SnapshotKey {
+  int64_t modifiedTime = 0;
+  uint64_t fileSize = 0;
+  uint64_t contentHash = 0;
+};
+
+// Read-only view of a whole file. Empty files open successfully with no data.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::wstring& path) {
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                         FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+      return;
+    }
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(m_file, &size)) {
+      return;
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+    if (m_size == 0) {
+      m_open = true;
+      return;
+    }
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping) {
+      return;
+    }
+    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    m_open = m_data != nullptr;
+  }
+
+  ~MappedFile() {
+    if (m_data) {
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+      CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+      CloseHandle(m_file);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool IsOpen() const { return m_open; }
+  const uint8_t* Data() const { return m_data; }
+  size_t Size() const { return m_size; }
+
+ private:
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+  bool m_open = false;
+};
+
+std::filesystem::path RecentDirectory() {
+  std::filesystem::path path = AppDataDirectory();
+  path /= L"recent";
+  std::error_code ec;
+  std::filesystem::create_directories(path, ec);
+  return path;
+}
+
+std::wstring SnapshotPath(const std::wstring& path) {
+  uint64_t key = HashBytes(path.data(), path.size() * sizeof(wchar_t));
+  std::wstringstream name;
+  name << std::hex << key << L".bin";
+  return (RecentDirectory() / name.str()).wstring();
+}
+
+void DeleteSnapshot(const std::wstring& path) {
+  std::error_code ec;
+  std::filesystem::remove(SnapshotPath(path), ec);
+}
+
+bool SourceMissing(const std::wstring& path) {
+  if (GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES) {
+    return false;
+  }
+  DWORD error = GetLastError();
+  return error == ERROR_FILE_NOT_FOUND || error == ERROR_PATH_NOT_FOUND;
+}
+
+bool ReadSourceKey(const std::wstring& path, SnapshotKey& key) {
+  if (!StatFile(path, key.modifiedTime, key.fileSize)) {
+    return false;
+  }
+  MappedFile source(path);
+  if (!source.IsOpen() || source.Size() != key.fileSize) {
+    return false;
+  }
+  key.contentHash = HashBytes(source.Data(), source.Size());
+  return true;
+}
+
+bool WriteSnapshot(const std::wstring& path, const MacroDocument& document, const SnapshotKey& key,
+                   double coldMillis) {
+  TRACE_ZONE("WriteSnapshot");
+  std::string strings;
+  auto addString = [&strings](const std::string& value, uint32_t& offset, uint32_t& length) {
+    offset = static_cast<uint32_t>(strings.size());
+    length = static_cast<uint32_t>(value.size());
+    strings += value;
+  };
+  std::vector<SnapshotAction> actions;
+  auto addAction = [&](const MacroAction& action) {
+    SnapshotAction packed{};
+    packed.delay = action.delay;
+    packed.x = action.x;
+    packed.y = action.y;
+    packed.interval = action.interval;
+    packed.count = action.count;
+    packed.repeat = action.repeat;
+    packed.kind = static_cast<uint8_t>(action.kind);
+    packed.button = static_cast<uint8_t>(action.button);
+    addString(action.id, packed.idOffset, packed.idLength);
+    addString(action.block, packed.blockOffset, packed.blockLength);
+    actions.push_back(packed);
+  };
+
+  for (const auto& action : document.steps) {
+    addAction(action);
+  }
+  std::vector<SnapshotBlock> blocks;
+  for (const auto& [id, block] : document.blocks) {
+    SnapshotBlock packed{};
+    addString(id, packed.idOffset, packed.idLength);
+    packed.firstAction = static_cast<uint32_t>(actions.size());
+    packed.actionCount = static_cast<uint32_t>(block->size());
+    for (const auto& action : *block) {
+      addAction(action);
+    }
+    blocks.push_back(packed);
+  }
+
+  SnapshotHeader header{};
+  header.magic = kSnapshotMagic;
+  header.version = kSnapshotVersion;
+  header.modifiedTime = key.modifiedTime;
+  header.fileSize = key.fileSize;
+  header.contentHash = key.contentHash;
+  header.coldMillis = coldMillis;
+  header.stepCount = static_cast<uint32_t>(document.steps.size());
+  header.blockCount = static_cast<uint32_t>(blocks.size());
+  header.actionCount = static_cast<uint32_t>(actions.size());
+  header.stringBytes = static_cast<uint32_t>(strings.size());
+
+  // The open worker and the save thread can refresh the same snapshot at once,
+  // and a reader must never map a half-written one.
+  return WriteFileAtomically(SnapshotPath(path), [&](std::ostream& stream) {
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(reinterpret_cast<const char*>(blocks.data()),
+                 static_cast<std::streamsize>(blocks.size() * sizeof(SnapshotBlock)));
+    stream.write(reinterpret_cast<const char*>(actions.data()),
+                 static_cast<std::streamsize>(actions.size() * sizeof(SnapshotAction)));
+    stream.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+  });
+}
+
+bool DecodeSnapshot(const MappedFile& snapshot, MacroDocument& document) {
+  const uint8_t* data = snapshot.Data();
+  const auto* header = reinterpret_cast<const SnapshotHeader*>(data);
+  const auto* blocks = reinterpret_cast<const SnapshotBlock*>(data + sizeof(SnapshotHeader));
+  const auto* actions = reinterpret_cast<const SnapshotAction*>(blocks + header->blockCount);
+  const char* strings = reinterpret_cast<const char*>(actions + header->actionCount);
+
+  auto readString = [&](uint32_t offset, uint32_t length, std::string& value) {
+    if (static_cast<uint64_t>(offset) + length > header->stringBytes) {
+      return false;
+    }
+    value.assign(strings + offset, length);
+    return true;
+  };
+  auto readAction = [&](const SnapshotAction& packed, MacroAction& action) {
+    if (packed.kind > static_cast<uint8_t>(ActionKind::Call) ||
+        packed.button > static_cast<uint8_t>(ActionKind::Call)) {
+      return false;
+    }
+    action.delay = packed.delay;
+    action.x = packed.x;
+    action.y = packed.y;
+    action.interval = packed.interval;
+    action.count = packed.count;
+    action.repeat = packed.repeat;
+    action.kind = static_cast<ActionKind>(packed.kind);
+    action.button = static_cast<ActionKind>(packed.button);
+    return readString(packed.idOffset, packed.idLength, action.id) &&
+           readString(packed.blockOffset, packed.blockLength, action.block);
+  };
+
+  if (header->stepCount > header->actionCount) {
+    return false;
+  }
+  document.steps.resize(header->stepCount);
+  for (uint32_t i = 0; i < header->stepCount; ++i) {
+    if (!readAction(actions[i], document.steps[i])) {
+      return false;
+    }
+  }
+  document.blocks.clear();
+  for (uint32_t b = 0; b < header->blockCount; ++b) {
+    const auto& packed = blocks[b];
+    if (packed.firstAction < header->stepCount ||
+        static_cast<uint64_t>(packed.firstAction) + packed.actionCount > header->actionCount) {
+      return false;
+    }
+    std::string id;
+    std::vector<MacroAction> steps(packed.actionCount);
+    if (!readString(packed.idOffset, packed.idLength, id)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < packed.actionCount; ++i) {
+      if (!readAction(actions[packed.firstAction + i], steps[i])) {
+        return false;
+      }
+    }
+    document.blocks.emplace(std::move(id), std::make_shared<const std::vector<MacroAction>>(std::move(steps)));
+  }
+  return true;
+}
+}  // namespace
+
+std::vector<std::wstring> LoadRecentMacros() {
+  std::vector<std::wstring> paths;
+  std::ifstream stream(RecentDirectory() / L"recent.json", std::ios::binary);
+  if (!stream) {
+    return paths;
+  }
+  std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  try {
+    JsonArray array = JsonArray::Parse(winrt::to_hstring(text));
+    for (uint32_t i = 0; i < array.Size() && paths.size() < kMaxRecentMacros; ++i) {
+      paths.emplace_back(array.GetStringAt(i).c_str());
+    }
+  } catch (...) {
+    paths.clear();
+  }
+  return paths;
+}
+
+void SaveRecentMacros(const std::vector<std::wstring>& paths) {
+  JsonArray array;
+  for (const auto& path : paths) {
+    array.Append(JsonValue::CreateStringValue(path));
+  }
+  auto text = winrt::to_string(array.Stringify());
+  WriteFileAtomically((RecentDirectory() / L"recent.json").wstring(), [&text](std::ostream& stream) {
+    stream.write(text.data(), static_cast<std::streamsize>(text.size()));
+  });
+}
+
+void TouchRecentMacro(std::vector<std::wstring>& paths, const std::wstring& path) {
+  paths.erase(std::remove(paths.begin(), paths.end(), path), paths.end());
+  paths.insert(paths.begin(), path);
+  while (paths.size() > kMaxRecentMacros) {
+    DeleteSnapshot(paths.back());
+    paths.pop_back();
+  }
+}
+
+void ForgetRecentMacro(std::vector<std::wstring>& paths, const std::wstring& path) {
+  paths.erase(std::remove(paths.begin(), paths.end(), path), paths.end());
+  DeleteSnapshot(path);
+}
+
+bool LoadMacroSnapshot(const std::wstring& path, MacroDocument& document, double& coldMillis) {
+  TRACE_ZONE("LoadSnapshot");
+  MappedFile snapshot(SnapshotPath(path));
+  if (!snapshot.IsOpen() || snapshot.Size() < sizeof(SnapshotHeader)) {
+    return false;
+  }
+  SnapshotHeader header{};
+  std::memcpy(&header, snapshot.Data(), sizeof(header));
+  const uint64_t expected = sizeof(SnapshotHeader) + uint64_t{header.blockCount} * sizeof(SnapshotBlock) +
+                            uint64_t{header.actionCount} * sizeof(SnapshotAction) + header.stringBytes;
+  if (header.magic != kSnapshotMagic || header.version != kSnapshotVersion || expected != snapshot.Size()) {
+    return false;
+  }
+
+  // Cheap checks first; the content hash only runs when the file looks unchanged.
+  int64_t modifiedTime = 0;
+  uint64_t fileSize = 0;
+  if (!StatFile(path, modifiedTime, fileSize) || modifiedTime != header.modifiedTime ||
+      fileSize != header.fileSize) {
+    return false;
+  }
+  SnapshotKey key{};
+  if (!ReadSourceKey(path, key) || key.contentHash != header.contentHash) {
+    return false;
+  }
+
+  MacroDocument decoded;
+  if (!DecodeSnapshot(snapshot, decoded)) {
+    return false;
+  }
+  document = std::move(decoded);
+  coldMillis = header.coldMillis;
+  return true;
+}
+
+bool SaveMacroSnapshot(const std::wstring& path, const MacroDocument& document, double coldMillis) {
+  SnapshotKey key{};
+  return ReadSourceKey(path, key) && WriteSnapshot(path, document, key, coldMillis);
+}
+
+MacroOpenResult OpenMacroCached(const std::wstring& path, MacroDocument& document) {
+  TRACE_ZONE("OpenMacroCached");
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  MacroOpenResult result{};
+
+  if (LoadMacroSnapshot(path, document, result.coldMillis)) {
+    result.ok = true;
+    result.warm = true;
+    int64_t modifiedTime = 0;
+    StatFile(path, modifiedTime, result.fileBytes);
+    result.millis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return result;
+  }
+
+  // Stat before reading: if the file changes mid-parse the snapshot's mtime
+  // is already stale, so the next open parses again instead of trusting it.
+  SnapshotKey key{};
+  if (!StatFile(path, key.modifiedTime, key.fileSize)) {
+    result.missing = SourceMissing(path);
+    return result;
+  }
+  std::ifstream stream(std::filesystem::path(path), std::ios::binary);
+  if (!stream) {
+    result.missing = SourceMissing(path);
+    return result;
+  }
+  std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  key.contentHash = HashBytes(text.data(), text.size());
+
+  MacroDocument parsed;
+  if (!ParseMacroDocument(winrt::to_hstring(text), parsed)) {
+    return result;
+  }
+  result.dedup = DeduplicateBlocks(parsed);
+  result.ok = true;
+  result.fileBytes = text.size();
+  result.millis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  result.coldMillis = result.millis;
+  WriteSnapshot(path, parsed, key, result.millis);
+  document = std::move(parsed);
+  return result;
+}
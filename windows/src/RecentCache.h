@@ -0,0 +1,40 @@
+#pragma once
+
+#include "MacroAction.h"
+#include "MacroBlocks.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr size_t kMaxRecentMacros = 12;
+
+struct MacroOpenResult {
+  bool ok = false;
+  // True when the document came from a snapshot instead of a JSON parse.
+  bool warm = false;
+  double millis = 0.0;
+  // Time the cold parse took when the snapshot was written; 0 if unknown.
+  double coldMillis = 0.0;
+  uint64_t fileBytes = 0;
+  // True only when the file itself is gone; other failures may be transient.
+  bool missing = false;
+  DedupStats dedup{};
+};
+
+// Most recently opened macro paths, newest first, persisted next to the library index.
+std::vector<std::wstring> LoadRecentMacros();
+void SaveRecentMacros(const std::vector<std::wstring>& paths);
+// Both delete the snapshots of paths that leave the list.
+void TouchRecentMacro(std::vector<std::wstring>& paths, const std::wstring& path);
+void ForgetRecentMacro(std::vector<std::wstring>& paths, const std::wstring& path);
+
+// Binary snapshots of parsed, deduplicated documents under AppData\recent.
+// A snapshot is only used while the source file's modification time, size
+// and content hash all match what was recorded when it was written.
+bool LoadMacroSnapshot(const std::wstring& path, MacroDocument& document, double& coldMillis);
+bool SaveMacroSnapshot(const std::wstring& path, const MacroDocument& document, double coldMillis);
+
+// Tries the snapshot first and falls back to a full parse plus deduplication,
+// refreshing the snapshot whenever it had to parse.
+MacroOpenResult OpenMacroCached(const std::wstring& path, MacroDocument& document);
@@ -0,0 +1,292 @@
+#include "pch.h"
+#include "SpatialIndex.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace {
+// Cell coordinates are clamped well inside int32_t so the cast is defined and
+// differences between two coordinates cannot overflow.
+constexpr double kCellLimit = 1 << 30;
+}  // namespace
+
+int32_t SpatialIndex::CellCoord(double value) const {
+  double cell = std::floor(value / m_cellSize);
+  // Written so NaN lands on the lower limit as well.
+  if (!(cell > -kCellLimit)) {
+    return static_cast<int32_t>(-kCellLimit);
+  }
+  return static_cast<int32_t>(std::min(cell, kCellLimit));
+}
+
+uint64_t SpatialIndex::CellKey(int32_t cx, int32_t cy) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+}
+
+void SpatialIndex::Clear() {
+  m_cells.clear();
+  m_minCellX = 0;
+  m_minCellY = 0;
+  m_maxCellX = -1;
+  m_maxCellY = -1;
+  m_size = 0;
+}
+
+void SpatialIndex::Reset(const std::vector<MacroAction>& actions) {
+  TRACE_ZONE("SpatialIndexReset");
+  Clear();
+  for (size_t i = 0; i < actions.size(); ++i) {
+    if (HasPosition(actions[i])) {
+      Insert(i, actions[i].x, actions[i].y);
+    }
+  }
+}
+
+void SpatialIndex::Insert(size_t index, double x, double y) {
+  int32_t cx = CellCoord(x);
+  int32_t cy = CellCoord(y);
+  m_cells[CellKey(cx, cy)].push_back(Entry{static_cast<uint32_t>(index), static_cast<float>(x), static_cast<float>(y)});
+  if (m_size == 0) {
+    m_minCellX = m_maxCellX = cx;
+    m_minCellY = m_maxCellY = cy;
+  } else {
+    m_minCellX = std::min(m_minCellX, cx);
+    m_minCellY = std::min(m_minCellY, cy);
+    m_maxCellX = std::max(m_maxCellX, cx);
+    m_maxCellY = std::max(m_maxCellY, cy);
+  }
+  ++m_size;
+}
+
+void SpatialIndex::Remove(size_t index, double x, double y) {
+  auto cell = m_cells.find(CellKey(CellCoord(x), CellCoord(y)));
+  if (cell == m_cells.end()) {
+    return;
+  }
+  auto& entries = cell->second;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].index == index) {
+      entries[i] = entries.back();
+      entries.pop_back();
+      --m_size;
+      break;
+    }
+  }
+  if (entries.empty()) {
+    m_cells.erase(cell);
+  }
+}
+
+void SpatialIndex::Update(size_t index, const MacroAction& before, const MacroAction& after) {
+  if (HasPosition(before)) {
+    Remove(index, before.x, before.y);
+  }
+  if (HasPosition(after)) {
+    Insert(index, after.x, after.y);
+  }
+}
+
+std::vector<size_t> SpatialIndex::QueryRegion(double left, double top, double right, double bottom) const {
+  TRACE_ZONE("SpatialQueryRegion");
+  std::vector<size_t> result;
+  if (m_size == 0) {
+    return result;
+  }
+  if (left > right) {
+    std::swap(left, right);
+  }
+  if (top > bottom) {
+    std::swap(top, bottom);
+  }
+
+  auto collect = [&](const std::vector<Entry>& entries) {
+    for (const auto& entry : entries) {
+      if (entry.x >= left && entry.x <= right && entry.y >= top && entry.y <= bottom) {
+        result.push_back(entry.index);
+      }
+    }
+  };
+
+  int32_t x0 = std::max(CellCoord(left), m_minCellX);
+  int32_t y0 = std::max(CellCoord(top), m_minCellY);
+  int32_t x1 = std::min(CellCoord(right), m_maxCellX);
+  int32_t y1 = std::min(CellCoord(bottom), m_maxCellY);
+  if (x0 > x1 || y0 > y1) {
+    return result;
+  }
+
+  // Very large regions are cheaper to answer by walking the occupied cells.
+  uint64_t spanned = static_cast<uint64_t>(x1 - x0 + 1) * static_cast<uint64_t>(y1 - y0 + 1);
+  if (spanned > m_cells.size()) {
+    for (const auto& [key, entries] : m_cells) {
+      collect(entries);
+    }
+  } else {
+    for (int32_t cx = x0; cx <= x1; ++cx) {
+      for (int32_t cy = y0; cy <= y1; ++cy) {
+        auto cell = m_cells.find(CellKey(cx, cy));
+        if (cell != m_cells.end()) {
+          collect(cell->second);
+        }
+      }
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+bool SpatialIndex::Nearest(double x, double y, size_t& index) const {
+  TRACE_ZONE("SpatialNearest");
+  if (m_size == 0) {
+    return false;
+  }
+
+  // Rings start from the query cell clamped into the occupied bounds, so a far
+  // away query does not walk empty rings to reach them. Every cell in ring r
+  // is still at least (r - 1) whole cells from the query itself.
+  int32_t cx = std::clamp(CellCoord(x), m_minCellX, m_maxCellX);
+  int32_t cy = std::clamp(CellCoord(y), m_minCellY, m_maxCellY);
+  int32_t maxRing = std::max({cx - m_minCellX, m_maxCellX - cx, cy - m_minCellY, m_maxCellY - cy});
+  double best = std::numeric_limits<double>::max();
+  bool found = false;
+
+  auto consider = [&](const std::vector<Entry>& entries) {
+    for (const auto& entry : entries) {
+      double ddx = entry.x - x;
+      double ddy = entry.y - y;
+      double distance = ddx * ddx + ddy * ddy;
+      if (distance < best || (found && distance == best && entry.index < index)) {
+        best = distance;
+        index = entry.index;
+        found = true;
+      }
+    }
+  };
+  auto visit = [&](int32_t gx, int32_t gy) {
+    auto cell = m_cells.find(CellKey(gx, gy));
+    if (cell != m_cells.end()) {
+      consider(cell->second);
+    }
+  };
+
+  for (int32_t ring = 0; ring <= maxRing; ++ring) {
+    // Anything in this ring or beyond is at least (ring - 1) whole cells away.
+    if (found) {
+      double reach = (ring - 1) * m_cellSize;
+      if (reach > 0 && reach * reach > best) {
+        break;
+      }
+    }
+    // Once the square walked so far covers more cells than are occupied,
+    // scanning the occupied cells directly is cheaper, as in QueryRegion.
+    uint64_t side = 2 * static_cast<uint64_t>(ring) + 1;
+    if (side * side > m_cells.size()) {
+      for (const auto& [key, entries] : m_cells) {
+        consider(entries);
+      }
+      break;
+    }
+    if (ring == 0) {
+      visit(cx, cy);
+      continue;
+    }
+    for (int32_t d = -ring; d <= ring; ++d) {
+      visit(cx + d, cy - ring);
+      visit(cx + d, cy + ring);
+    }
+    for (int32_t d = -ring + 1; d <= ring - 1; ++d) {
+      visit(cx - ring, cy + d);
+      visit(cx + ring, cy + d);
+    }
+  }
+  return found;
+}
+
+void SpatialIndex::Transform(std::vector<MacroAction>& actions, const std::vector<size_t>& selection, double dx,
+                             double dy, double scale, double originX, double originY) {
+  TRACE_ZONE("SpatialTransform");
+  const size_t count = selection.size();
+  std::vector<double> xs(count);
+  std::vector<double> ys(count);
+  for (size_t i = 0; i < count; ++i) {
+    xs[i] = actions[selection[i]].x;
+    ys[i] = actions[selection[i]].y;
+  }
+
+  // Structure-of-arrays keeps this loop branch-free so the compiler can vectorize it.
+  const double offsetX = originX - originX * scale + dx;
+  const double offsetY = originY - originY * scale + dy;
+  std::vector<double> newXs(count);
+  std::vector<double> newYs(count);
+  for (size_t i = 0; i < count; ++i) {
+    newXs[i] = xs[i] * scale + offsetX;
+    newYs[i] = ys[i] * scale + offsetY;
+  }
+
+  const bool rebuild = count > m_size / 4;
+  for (size_t i = 0; i < count; ++i) {
+    auto& action = actions[selection[i]];
+    action.x = newXs[i];
+    action.y = newYs[i];
+    if (!rebuild && HasPosition(action)) {
+      Remove(selection[i], xs[i], ys[i]);
+      Insert(selection[i], newXs[i], newYs[i]);
+    }
+  }
+  if (rebuild) {
+    Reset(actions);
+  }
+}
+
+SpatialBenchmark RunSpatialBenchmark(size_t points, size_t queries) {
+  using Clock = std::chrono::steady_clock;
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<double> coordinate(0.0, 3840.0);
+
+  std::vector<MacroAction> actions(points);
+  for (auto& action : actions) {
+    action.kind = ActionKind::LeftClick;
+    action.x = coordinate(rng);
+    action.y = coordinate(rng);
+  }
+
+  SpatialBenchmark result{};
+  result.points = points;
+  SpatialIndex index;
+
+  auto start = Clock::now();
+  index.Reset(actions);
+  result.buildMillis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  queries = std::max<size_t>(1, queries);
+  size_t sink = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < queries; ++i) {
+    double x = coordinate(rng);
+    double y = coordinate(rng);
+    sink += index.QueryRegion(x, y, x + 100.0, y + 100.0).size();
+  }
+  result.regionMicros = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / queries;
+
+  start = Clock::now();
+  for (size_t i = 0; i < queries; ++i) {
+    size_t nearest = 0;
+    sink += index.Nearest(coordinate(rng), coordinate(rng), nearest) ? nearest : 0;
+  }
+  result.nearestMicros = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / queries;
+
+  auto selection = index.QueryRegion(0.0, 0.0, 1920.0, 1080.0);
+  start = Clock::now();
+  index.Transform(actions, selection, 25.0, -10.0, 1.0, 0.0, 0.0);
+  result.translateMillis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  // Keeps the optimizer from discarding the query loops.
+  if (sink == std::numeric_limits<size_t>::max()) {
+    result.points = 0;
+  }
+  return result;
+}
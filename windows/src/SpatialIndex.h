@@ -0,0 +1,58 @@
+#pragma once
+
+#include "MacroAction.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+struct SpatialBenchmark {
+  size_t points = 0;
+  double buildMillis = 0.0;
+  double regionMicros = 0.0;
+  double nearestMicros = 0.0;
+  double translateMillis = 0.0;
+};
+
+// Uniform grid over the positions of steps that click somewhere. Each cell
+// keeps its own copy of the coordinates so queries never touch the action
+// vector. Erasing a step renumbers everything after it, so callers rebuild
+// with Reset; every other edit is an O(1) cell update.
+class SpatialIndex {
+ public:
+  explicit SpatialIndex(double cellSize = 64.0) : m_cellSize(cellSize) {}
+
+  void Reset(const std::vector<MacroAction>& actions);
+  void Clear();
+  void Insert(size_t index, double x, double y);
+  void Remove(size_t index, double x, double y);
+  void Update(size_t index, const MacroAction& before, const MacroAction& after);
+
+  std::vector<size_t> QueryRegion(double left, double top, double right, double bottom) const;
+  bool Nearest(double x, double y, size_t& index) const;
+  // Moves each selected step to origin + (p - origin) * scale + offset and keeps the grid in sync.
+  void Transform(std::vector<MacroAction>& actions, const std::vector<size_t>& selection, double dx, double dy,
+                 double scale, double originX, double originY);
+
+  size_t Size() const { return m_size; }
+
+ private:
+  struct Entry {
+    uint32_t index;
+    float x;
+    float y;
+  };
+
+  int32_t CellCoord(double value) const;
+  static uint64_t CellKey(int32_t cx, int32_t cy);
+
+  double m_cellSize;
+  std::unordered_map<uint64_t, std::vector<Entry>> m_cells{};
+  int32_t m_minCellX = 0;
+  int32_t m_minCellY = 0;
+  int32_t m_maxCellX = -1;
+  int32_t m_maxCellY = -1;
+  size_t m_size = 0;
+};
+
+SpatialBenchmark RunSpatialBenchmark(size_t points, size_t queries);
@@ -0,0 +1,102 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+  }
+  m_queues.reserve(threadCount);
+  for (size_t i = 0; i < threadCount; ++i) {
+    m_queues.push_back(std::make_unique<WorkQueue>());
+  }
+  m_workers.reserve(threadCount);
+  for (size_t i = 0; i < threadCount; ++i) {
+    m_workers.emplace_back([this, i]() { WorkerLoop(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_shutdown = true;
+  }
+  m_wake.notify_all();
+  for (auto& worker : m_workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  size_t index = m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+  m_pending.fetch_add(1, std::memory_order_acq_rel);
+  {
+    // Counted before the push so a thief never decrements below zero.
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_queued.fetch_add(1, std::memory_order_acq_rel);
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+    m_queues[index]->tasks.push_back(std::move(task));
+  }
+  m_wake.notify_one();
+}
+
+void ThreadPool::WaitIdle() {
+  std::unique_lock<std::mutex> lock(m_wakeMutex);
+  m_idle.wait(lock, [this]() { return m_pending.load(std::memory_order_acquire) == 0; });
+}
+
+bool ThreadPool::TryPop(size_t index, std::function<void()>& task) {
+  auto& queue = *m_queues[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+  task = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  m_queued.fetch_sub(1, std::memory_order_acq_rel);
+  return true;
+}
+
+bool ThreadPool::TrySteal(size_t index, std::function<void()>& task) {
+  for (size_t offset = 1; offset < m_queues.size(); ++offset) {
+    auto& victim = *m_queues[(index + offset) % m_queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      m_queued.fetch_sub(1, std::memory_order_acq_rel);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+  winrt::init_apartment(winrt::apartment_type::multi_threaded);
+  for (;;) {
+    std::function<void()> task;
+    if (TryPop(index, task) || TrySteal(index, task)) {
+      try {
+        task();
+      } catch (...) {
+      }
+      if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_idle.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    m_wake.wait(lock, [this]() { return m_shutdown || m_queued.load(std::memory_order_acquire) > 0; });
+    if (m_shutdown) {
+      break;
+    }
+  }
+  winrt::uninit_apartment();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool where every worker owns a deque. Workers pop their own
+// newest task first and steal the oldest task from a sibling when idle.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void Submit(std::function<void()> task);
+  void WaitIdle();
+  size_t ThreadCount() const { return m_queues.size(); }
+
+ private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void WorkerLoop(size_t index);
+  bool TryPop(size_t index, std::function<void()>& task);
+  bool TrySteal(size_t index, std::function<void()>& task);
+
+  std::vector<std::unique_ptr<WorkQueue>> m_queues{};
+  std::vector<std::thread> m_workers{};
+  std::atomic<size_t> m_nextQueue{0};
+  std::atomic<size_t> m_queued{0};
+  std::atomic<size_t> m_pending{0};
+  std::mutex m_wakeMutex{};
+  std::condition_variable m_wake{};
+  std::condition_variable m_idle{};
+  bool m_shutdown = false;
+};
@@ -0,0 +1,163 @@
+#include "pch.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> g_traceEnabled{false};
+
+namespace {
+constexpr size_t kEventsPerThread = 1 << 16;
+
+struct TraceEvent {
+  const char* name;
+  int64_t start;
+  int64_t end;
+  DWORD threadId;
+};
+
+// Only the owning thread writes events and count; exporters read up to an
+// acquire-loaded count. A generation bump lets the owner lazily discard old
+// events the next time it records, so no thread ever resets another's buffer.
+// That reset is the only time the owner overwrites events an exporter may be
+// reading, so it and the exporter's copy both hold resetMutex; appends do not.
+// Buffers outlive their threads and are handed to the next new thread, which
+// appends after the events already there; each event carries its own thread id.
+struct ThreadBuffer {
+  bool inUse = false;
+  uint32_t generation = 0;
+  std::unique_ptr<TraceEvent[]> events = std::make_unique<TraceEvent[]>(kEventsPerThread);
+  std::atomic<size_t> count{0};
+  std::atomic<uint32_t> publishedGeneration{0};
+  std::mutex resetMutex;
+};
+
+std::atomic<uint32_t> g_generation{1};
+std::mutex g_buffersMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+
+// Returns the thread's buffer to the pool when the thread exits, so the pool
+// only grows to the number of threads that trace at the same time.
+struct BufferLease {
+  ThreadBuffer* buffer = nullptr;
+  DWORD threadId = 0;
+
+  ~BufferLease() {
+    if (buffer) {
+      std::lock_guard<std::mutex> lock(g_buffersMutex);
+      buffer->inUse = false;
+    }
+  }
+};
+
+BufferLease& CurrentLease() {
+  thread_local BufferLease lease;
+  if (!lease.buffer) {
+    lease.threadId = GetCurrentThreadId();
+    std::lock_guard<std::mutex> lock(g_buffersMutex);
+    for (const auto& buffer : g_buffers) {
+      if (!buffer->inUse) {
+        lease.buffer = buffer.get();
+        break;
+      }
+    }
+    if (!lease.buffer) {
+      g_buffers.push_back(std::make_unique<ThreadBuffer>());
+      lease.buffer = g_buffers.back().get();
+    }
+    lease.buffer->inUse = true;
+  }
+  return lease;
+}
+
+}  // namespace
+
+int64_t TraceTimestamp() {
+  LARGE_INTEGER value{};
+  QueryPerformanceCounter(&value);
+  return value.QuadPart;
+}
+
+int64_t TraceTicksPerSecond() {
+  static const int64_t frequency = []() {
+    LARGE_INTEGER value{};
+    QueryPerformanceFrequency(&value);
+    return value.QuadPart;
+  }();
+  return frequency;
+}
+
+void RecordTraceZone(const char* name, int64_t start, int64_t end) {
+  auto& lease = CurrentLease();
+  auto* buffer = lease.buffer;
+  uint32_t generation = g_generation.load(std::memory_order_acquire);
+  if (buffer->generation != generation) {
+    std::lock_guard<std::mutex> lock(buffer->resetMutex);
+    buffer->count.store(0, std::memory_order_release);
+    buffer->generation = generation;
+    buffer->publishedGeneration.store(generation, std::memory_order_release);
+  }
+  size_t index = buffer->count.load(std::memory_order_relaxed);
+  if (index >= kEventsPerThread) {
+    return;
+  }
+  buffer->events[index] = TraceEvent{name, start, end, lease.threadId};
+  buffer->count.store(index + 1, std::memory_order_release);
+}
+
+void SetTraceEnabled(bool enabled) {
+  if (enabled && !g_traceEnabled.load()) {
+    g_generation.fetch_add(1, std::memory_order_acq_rel);
+  }
+  g_traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool ExportTraceJson(const std::wstring& path) {
+  std::ofstream stream(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+  if (!stream) {
+    return false;
+  }
+
+  const double microsPerTick = 1'000'000.0 / static_cast<double>(TraceTicksPerSecond());
+  uint32_t generation = g_generation.load(std::memory_order_acquire);
+  bool first = true;
+  stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::fixed << std::setprecision(3);
+
+  // Copy each buffer under its reset lock so an owner starting a new
+  // generation cannot overwrite events halfway through the copy.
+  std::vector<TraceEvent> events;
+  {
+    std::lock_guard<std::mutex> lock(g_buffersMutex);
+    for (const auto& buffer : g_buffers) {
+      std::lock_guard<std::mutex> reset(buffer->resetMutex);
+      if (buffer->publishedGeneration.load(std::memory_order_acquire) != generation) {
+        continue;
+      }
+      size_t count = buffer->count.load(std::memory_order_acquire);
+      events.insert(events.end(), buffer->events.get(), buffer->events.get() + count);
+    }
+  }
+
+  // Ticks since boot are too large for a double to keep sub-millisecond
+  // precision once scaled, so timestamps are written relative to the first zone.
+  int64_t base = std::numeric_limits<int64_t>::max();
+  for (const auto& event : events) {
+    base = std::min(base, event.start);
+  }
+
+  for (const auto& event : events) {
+    stream << (first ? "" : ",") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":"
+           << GetCurrentProcessId() << ",\"tid\":" << event.threadId
+           << ",\"ts\":" << static_cast<double>(event.start - base) * microsPerTick
+           << ",\"dur\":" << static_cast<double>(event.end - event.start) * microsPerTick << "}";
+    first = false;
+  }
+  stream << "]}";
+  return static_cast<bool>(stream);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Lightweight scoped timing zones. Each thread appends to its own fixed
+// buffer without locking; ExportTraceJson writes Chrome/Perfetto trace JSON.
+extern std::atomic<bool> g_traceEnabled;
+
+inline bool TraceEnabled() {
+  return g_traceEnabled.load(std::memory_order_relaxed);
+}
+
+void SetTraceEnabled(bool enabled);
+bool ExportTraceJson(const std::wstring& path);
+// QueryPerformanceCounter ticks; also the clock for burst deadlines and service latencies.
+int64_t TraceTimestamp();
+int64_t TraceTicksPerSecond();
+void RecordTraceZone(const char* name, int64_t start, int64_t end);
+
+class TraceZone {
+ public:
+  explicit TraceZone(const char* name) : m_name(name), m_start(TraceEnabled() ? TraceTimestamp() : 0) {}
+  ~TraceZone() {
+    if (m_start != 0) {
+      RecordTraceZone(m_name, m_start, TraceTimestamp());
+    }
+  }
+
+  TraceZone(const TraceZone&) = delete;
+  TraceZone& operator=(const TraceZone&) = delete;
+
+ private:
+  const char* m_name;
+  int64_t m_start;
+};
+
+#define TRACE_ZONE_CONCAT_INNER(a, b) a##b
+#define TRACE_ZONE_CONCAT(a, b) TRACE_ZONE_CONCAT_INNER(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_ZONE_CONCAT(traceZone_, __LINE__)(name)